@@ -31,15 +31,57 @@
 #define SMASHFS_MAGIC				SMASHFS_MKTAG('S', 'M', 'S', 'H')
 #define SMASHFS_VERSION_0			SMASHFS_MKTAG('V', '0', '0', '0')
 
+/*
+ * version 1 changes the layout of version 0 as follows, images of other
+ * versions are rejected instead of being misread:
+ *   - the bloom filters table, which moves every super block field after
+ *     inodes_csize, and the filter offset bits
+ *   - the offset index of directories
+ *   - zstd and lz4 compression types
+ *   - per block stored, type and bcj bits, and the compression_types and
+ *     bcj_types masks of the super block
+ *   - the zstd dictionary region
+ *   - the extents bits of inodes and extent maps of split files
+ *   - all zero blocks, stored with a compressed size of 0
+ */
+#define SMASHFS_VERSION_1			SMASHFS_MKTAG('V', '0', '0', '1')
+#define SMASHFS_VERSION				SMASHFS_VERSION_1
+
 #define SMASHFS_START				0
 #define SMASHFS_NAME_LEN			256
 
+#define SMASHFS_COMPRESSION_TYPES		8
+#define SMASHFS_BCJ_TYPES			9
+
+#define SMASHFS_EXTENT_SIZE			8
+
+#define SMASHFS_FILTER_BITS			10
+#define SMASHFS_FILTER_HASHES			4
+
 enum smashfs_compression_type {
 	smashfs_compression_type_none		= 0x00,
 	smashfs_compression_type_gzip		= 0x01,
 	smashfs_compression_type_lzma		= 0x02,
 	smashfs_compression_type_lzo		= 0x03,
 	smashfs_compression_type_xz		= 0x04,
+	smashfs_compression_type_zstd		= 0x05,
+	smashfs_compression_type_lz4		= 0x06,
+};
+
+/*
+ * branch/call/jump filters of xz, applied to blocks of executable code
+ * before they are compressed. matched to elf e_machine.
+ */
+enum smashfs_bcj_type {
+	smashfs_bcj_type_none			= 0x00,
+	smashfs_bcj_type_x86			= 0x01,
+	smashfs_bcj_type_powerpc		= 0x02,
+	smashfs_bcj_type_ia64			= 0x03,
+	smashfs_bcj_type_arm			= 0x04,
+	smashfs_bcj_type_armthumb		= 0x05,
+	smashfs_bcj_type_sparc			= 0x06,
+	smashfs_bcj_type_arm64			= 0x07,
+	smashfs_bcj_type_riscv			= 0x08,
 };
 
 enum smashfs_inode_type {
@@ -70,11 +112,17 @@ struct smashfs_super_block {
 	uint32_t inodes_offset;
 	uint32_t inodes_size;
 	uint32_t inodes_csize;
+	uint32_t filters_offset;
+	uint32_t filters_size;
 	uint32_t blocks_offset;
 	uint32_t blocks_size;
 	uint32_t entries_offset;
 	uint32_t entries_size;
 	uint32_t compression_type;
+	uint32_t compression_types;
+	uint32_t dictionary_offset;
+	uint32_t dictionary_size;
+	uint32_t bcj_types;
 	struct {
 		struct {
 			uint32_t type;
@@ -88,12 +136,14 @@ struct smashfs_super_block {
 			uint32_t size;
 			uint32_t block;
 			uint32_t index;
+			uint32_t extents;
 			struct {
 				char content[0];
 			} regular_file;
 			struct {
 				uint32_t parent;
 				uint32_t nentries;
+				uint32_t index;
 				struct {
 					uint32_t number;
 					uint32_t length;
@@ -109,7 +159,13 @@ struct smashfs_super_block {
 			uint32_t offset;
 			uint32_t compressed_size;
 			uint32_t size;
+			uint32_t stored;
+			uint32_t type;
+			uint32_t bcj;
 		} block;
+		struct {
+			uint32_t offset;
+		} filter;
 	} bits;
 	struct {
 		struct {
@@ -121,3 +177,69 @@ struct smashfs_super_block {
 		} block;
 	} min;
 } __attribute__((packed));
+
+/*
+ * a stored block with a compressed size of 0 is all zeros, and has no data
+ * in the entries.
+ */
+
+/*
+ * a regular file with extents is stored in pieces. its entry holds the
+ * extent map, SMASHFS_EXTENT_SIZE bytes per extent in file order, a 32 bit
+ * offset into the entries followed by a 32 bit size, and the file is the
+ * concatenation of the extents.
+ */
+
+/*
+ * per directory bloom filter over entry names. filter of a directory is
+ * SMASHFS_FILTER_BITS bits per entry rounded up to bytes, and each name sets
+ * SMASHFS_FILTER_HASHES bits derived from a 64 bit fnv-1a hash with double
+ * hashing.
+ */
+
+static inline void smashfs_filter_hash (const char *name, unsigned int length, uint32_t *h1, uint32_t *h2)
+{
+	unsigned int i;
+	unsigned long long h;
+	h = 0xcbf29ce484222325ULL;
+	for (i = 0; i < length; i++) {
+		h ^= (unsigned char) name[i];
+		h *= 0x100000001b3ULL;
+	}
+	*h1 = (uint32_t) h;
+	*h2 = ((uint32_t) (h >> 32)) | 1;
+}
+
+static inline unsigned int smashfs_filter_size (unsigned long long nentries)
+{
+	return (nentries * SMASHFS_FILTER_BITS + 7) / 8;
+}
+
+static inline void smashfs_filter_add (unsigned char *filter, unsigned int size, const char *name, unsigned int length)
+{
+	unsigned int i;
+	uint32_t b;
+	uint32_t h1;
+	uint32_t h2;
+	smashfs_filter_hash(name, length, &h1, &h2);
+	for (i = 0; i < SMASHFS_FILTER_HASHES; i++) {
+		b = (h1 + i * h2) % (size * 8);
+		filter[b / 8] |= 1 << (b % 8);
+	}
+}
+
+static inline int smashfs_filter_test (const unsigned char *filter, unsigned int size, const char *name, unsigned int length)
+{
+	unsigned int i;
+	uint32_t b;
+	uint32_t h1;
+	uint32_t h2;
+	smashfs_filter_hash(name, length, &h1, &h2);
+	for (i = 0; i < SMASHFS_FILTER_HASHES; i++) {
+		b = (h1 + i * h2) % (size * 8);
+		if ((filter[b / 8] & (1 << (b % 8))) == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/err.h>
+#include <linux/version.h>
+
+#include "cache.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,19,0)
+#define READ_ONCE(x)		ACCESS_ONCE(x)
+#endif
+
+#define CACHE_HASH_BITS		6
+#define CACHE_HASH_SIZE		(1 << CACHE_HASH_BITS)
+
+enum cache_entry_status {
+	cache_entry_status_pending,
+	cache_entry_status_uptodate,
+	cache_entry_status_error,
+};
+
+struct cache_entry {
+	struct list_head list;
+	struct hlist_node hash;
+	long long number;
+	long long size;
+	int refcount;
+	int status;
+	void *buffer;
+};
+
+struct cache {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct list_head lru;
+	struct hlist_head hash[CACHE_HASH_SIZE];
+	long long size;
+	long long used;
+	long long unused;
+	long long block_size;
+	int (*fill) (void *context, long long number, void *buffer, long long size);
+	void *context;
+	struct shrinker shrinker;
+};
+
+static inline struct cache_entry * cache_lookup (struct cache *cache, long long number)
+{
+	struct cache_entry *entry;
+	struct hlist_head *head;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
+	struct hlist_node *node;
+#endif
+	head = &cache->hash[hash_64(number, CACHE_HASH_BITS)];
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry(entry, node, head, hash) {
+#else
+	hlist_for_each_entry(entry, head, hash) {
+#endif
+		if (entry->number == number) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static inline void cache_entry_free (struct cache_entry *entry)
+{
+	vfree(entry->buffer);
+	kfree(entry);
+}
+
+/*
+ * unused entries live on the lru list, least recently used first. entries
+ * that are being filled or referenced are kept off the list, so they are
+ * never evicted under a reader.
+ */
+static inline void cache_evict_locked (struct cache *cache, struct list_head *evicted)
+{
+	struct cache_entry *entry;
+	entry = list_first_entry(&cache->lru, struct cache_entry, list);
+	list_move_tail(&entry->list, evicted);
+	hlist_del_init(&entry->hash);
+	cache->used -= cache->block_size;
+	cache->unused -= 1;
+}
+
+static inline long long cache_evict (struct cache *cache, long long count)
+{
+	long long evicted;
+	struct list_head list;
+	struct cache_entry *entry;
+	struct cache_entry *nentry;
+	evicted = 0;
+	INIT_LIST_HEAD(&list);
+	spin_lock(&cache->lock);
+	while (evicted < count && !list_empty(&cache->lru)) {
+		cache_evict_locked(cache, &list);
+		evicted += 1;
+	}
+	spin_unlock(&cache->lock);
+	list_for_each_entry_safe(entry, nentry, &list, list) {
+		list_del(&entry->list);
+		cache_entry_free(entry);
+	}
+	return evicted;
+}
+
+static inline struct cache_entry * cache_entry_alloc (struct cache *cache)
+{
+	struct list_head list;
+	struct cache_entry *entry;
+	INIT_LIST_HEAD(&list);
+	spin_lock(&cache->lock);
+	if (cache->used + cache->block_size > cache->size &&
+	    !list_empty(&cache->lru)) {
+		cache_evict_locked(cache, &list);
+		entry = list_first_entry(&list, struct cache_entry, list);
+		list_del_init(&entry->list);
+		cache->used += cache->block_size;
+		spin_unlock(&cache->lock);
+		return entry;
+	}
+	cache->used += cache->block_size;
+	spin_unlock(&cache->lock);
+	entry = kmalloc(sizeof(struct cache_entry), GFP_KERNEL);
+	if (entry == NULL) {
+		goto bail;
+	}
+	entry->buffer = vmalloc(cache->block_size);
+	if (entry->buffer == NULL) {
+		kfree(entry);
+		goto bail;
+	}
+	INIT_LIST_HEAD(&entry->list);
+	INIT_HLIST_NODE(&entry->hash);
+	return entry;
+bail:
+	spin_lock(&cache->lock);
+	cache->used -= cache->block_size;
+	spin_unlock(&cache->lock);
+	return NULL;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,12,0)
+
+static int cache_shrink (struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct cache *cache;
+	cache = container_of(shrinker, struct cache, shrinker);
+	if (sc->nr_to_scan > 0) {
+		cache_evict(cache, sc->nr_to_scan);
+	}
+	return cache->unused;
+}
+
+#else
+
+static unsigned long cache_shrink_count (struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct cache *cache;
+	cache = container_of(shrinker, struct cache, shrinker);
+	return cache->unused;
+}
+
+static unsigned long cache_shrink_scan (struct shrinker *shrinker, struct shrink_control *sc)
+{
+	long long evicted;
+	struct cache *cache;
+	cache = container_of(shrinker, struct cache, shrinker);
+	evicted = cache_evict(cache, sc->nr_to_scan);
+	return (evicted > 0) ? evicted : SHRINK_STOP;
+}
+
+#endif
+
+struct cache * cache_create (long long size, long long block_size, int (*fill) (void *context, long long number, void *buffer, long long size), void *context)
+{
+	int i;
+	struct cache *cache;
+	cache = kzalloc(sizeof(struct cache), GFP_KERNEL);
+	if (cache == NULL) {
+		return NULL;
+	}
+	spin_lock_init(&cache->lock);
+	init_waitqueue_head(&cache->wait);
+	INIT_LIST_HEAD(&cache->lru);
+	for (i = 0; i < CACHE_HASH_SIZE; i++) {
+		INIT_HLIST_HEAD(&cache->hash[i]);
+	}
+	cache->size = max(size, block_size);
+	cache->used = 0;
+	cache->unused = 0;
+	cache->block_size = block_size;
+	cache->fill = fill;
+	cache->context = context;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,12,0)
+	cache->shrinker.shrink = cache_shrink;
+#else
+	cache->shrinker.count_objects = cache_shrink_count;
+	cache->shrinker.scan_objects = cache_shrink_scan;
+#endif
+	cache->shrinker.seeks = DEFAULT_SEEKS;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,12,0)
+	register_shrinker(&cache->shrinker);
+#else
+	if (register_shrinker(&cache->shrinker) != 0) {
+		kfree(cache);
+		return NULL;
+	}
+#endif
+	return cache;
+}
+
+void cache_destroy (struct cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+	unregister_shrinker(&cache->shrinker);
+	cache_evict(cache, LLONG_MAX);
+	kfree(cache);
+}
+
+/*
+ * returns a referenced, up to date entry for block number. concurrent
+ * callers asking for the same block wait for the first one to fill it
+ * instead of reading and decompressing it again.
+ */
+struct cache_entry * cache_get (struct cache *cache, long long number)
+{
+	int rc;
+	struct cache_entry *entry;
+	struct cache_entry *nentry;
+
+	nentry = NULL;
+again:
+	spin_lock(&cache->lock);
+	entry = cache_lookup(cache, number);
+	if (entry != NULL) {
+		if (entry->refcount++ == 0 && entry->status == cache_entry_status_uptodate) {
+			list_del_init(&entry->list);
+			cache->unused -= 1;
+		}
+		spin_unlock(&cache->lock);
+		if (nentry != NULL) {
+			spin_lock(&cache->lock);
+			cache->used -= cache->block_size;
+			spin_unlock(&cache->lock);
+			cache_entry_free(nentry);
+		}
+		wait_event(cache->wait, READ_ONCE(entry->status) != cache_entry_status_pending);
+		smp_rmb();
+		if (entry->status != cache_entry_status_uptodate) {
+			cache_put(cache, entry);
+			return ERR_PTR(-EIO);
+		}
+		return entry;
+	}
+	if (nentry == NULL) {
+		spin_unlock(&cache->lock);
+		nentry = cache_entry_alloc(cache);
+		if (nentry == NULL) {
+			return ERR_PTR(-ENOMEM);
+		}
+		goto again;
+	}
+	nentry->number = number;
+	nentry->size = 0;
+	nentry->refcount = 1;
+	nentry->status = cache_entry_status_pending;
+	hlist_add_head(&nentry->hash, &cache->hash[hash_64(number, CACHE_HASH_BITS)]);
+	spin_unlock(&cache->lock);
+
+	rc = cache->fill(cache->context, number, nentry->buffer, cache->block_size);
+
+	spin_lock(&cache->lock);
+	if (rc < 0) {
+		nentry->status = cache_entry_status_error;
+		hlist_del_init(&nentry->hash);
+	} else {
+		nentry->size = rc;
+		smp_wmb();
+		nentry->status = cache_entry_status_uptodate;
+	}
+	spin_unlock(&cache->lock);
+	wake_up_all(&cache->wait);
+	if (rc < 0) {
+		cache_put(cache, nentry);
+		return ERR_PTR(rc);
+	}
+	return nentry;
+}
+
+void cache_put (struct cache *cache, struct cache_entry *entry)
+{
+	struct list_head list;
+	struct cache_entry *nentry;
+	INIT_LIST_HEAD(&list);
+	spin_lock(&cache->lock);
+	if (--entry->refcount > 0) {
+		spin_unlock(&cache->lock);
+		return;
+	}
+	if (entry->status != cache_entry_status_uptodate) {
+		cache->used -= cache->block_size;
+		spin_unlock(&cache->lock);
+		cache_entry_free(entry);
+		return;
+	}
+	list_add_tail(&entry->list, &cache->lru);
+	cache->unused += 1;
+	while (cache->used > cache->size && !list_empty(&cache->lru)) {
+		cache_evict_locked(cache, &list);
+	}
+	spin_unlock(&cache->lock);
+	list_for_each_entry_safe(entry, nentry, &list, list) {
+		list_del(&entry->list);
+		cache_entry_free(entry);
+	}
+}
+
+void * cache_entry_buffer (struct cache_entry *entry)
+{
+	return entry->buffer;
+}
+
+long long cache_entry_size (struct cache_entry *entry)
+{
+	return entry->size;
+}
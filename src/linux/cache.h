@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+struct cache;
+struct cache_entry;
+
+struct cache * cache_create (long long size, long long block_size, int (*fill) (void *context, long long number, void *buffer, long long size), void *context);
+void cache_destroy (struct cache *cache);
+struct cache_entry * cache_get (struct cache *cache, long long number);
+void cache_put (struct cache *cache, struct cache_entry *entry);
+void * cache_entry_buffer (struct cache_entry *entry);
+long long cache_entry_size (struct cache_entry *entry);
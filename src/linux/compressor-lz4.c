@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/lz4.h>
+
+#include "compressor-lz4.h"
+
+int lz4_uncompress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	int rc;
+	(void) context;
+	rc = LZ4_decompress_safe(src, dst, ssize, dsize);
+	if (rc < 0) {
+		return -1;
+	}
+	return rc;
+#else
+	int rc;
+	size_t out;
+	(void) context;
+	out = dsize;
+	rc = lz4_decompress_unknownoutputsize(src, ssize, dst, &out);
+	if (rc < 0) {
+		return -1;
+	}
+	return out;
+#endif
+}
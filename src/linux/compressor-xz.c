@@ -35,7 +35,7 @@ void * xz_create (void)
 	if (xz == NULL) {
 		return NULL;
 	}
-	xz->state = xz_dec_init(XZ_PREALLOC, 0);
+	xz->state = xz_dec_init(XZ_SINGLE, 0);
 	if (xz->state == NULL) {
 		kfree(xz);
 		return NULL;
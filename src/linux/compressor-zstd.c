@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/zstd.h>
+
+#include "compressor-zstd.h"
+
+/*
+ * the decompression context lives in a workspace allocated once per
+ * stream, so decoding a block never allocates. a dictionary is referenced,
+ * not copied, so it has to outlive the stream.
+ */
+struct zstd {
+	void *workspace;
+	ZSTD_DCtx *dctx;
+	void *dworkspace;
+	ZSTD_DDict *ddict;
+};
+
+void * zstd_create (void)
+{
+	size_t size;
+	struct zstd *zstd;
+	zstd = kzalloc(sizeof(struct zstd), GFP_KERNEL);
+	if (zstd == NULL) {
+		return NULL;
+	}
+	size = ZSTD_DCtxWorkspaceBound();
+	zstd->workspace = vmalloc(size);
+	if (zstd->workspace == NULL) {
+		kfree(zstd);
+		return NULL;
+	}
+	zstd->dctx = ZSTD_initDCtx(zstd->workspace, size);
+	if (zstd->dctx == NULL) {
+		vfree(zstd->workspace);
+		kfree(zstd);
+		return NULL;
+	}
+	return zstd;
+}
+
+void zstd_destroy (void *context)
+{
+	struct zstd *zstd;
+	if (context == NULL) {
+		return;
+	}
+	zstd = context;
+	if (zstd->dworkspace != NULL) {
+		vfree(zstd->dworkspace);
+	}
+	vfree(zstd->workspace);
+	kfree(zstd);
+}
+
+int zstd_dictionary (void *context, const void *dictionary, unsigned int size)
+{
+	size_t wsize;
+	struct zstd *zstd;
+	zstd = context;
+	wsize = ZSTD_DDictWorkspaceBound();
+	zstd->dworkspace = vmalloc(wsize);
+	if (zstd->dworkspace == NULL) {
+		return -1;
+	}
+	zstd->ddict = ZSTD_initDDict(dictionary, size, zstd->dworkspace, wsize);
+	if (zstd->ddict == NULL) {
+		vfree(zstd->dworkspace);
+		zstd->dworkspace = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int zstd_uncompress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	size_t rc;
+	struct zstd *zstd;
+	zstd = context;
+	if (zstd->ddict != NULL) {
+		rc = ZSTD_decompress_usingDDict(zstd->dctx, dst, dsize, src, ssize, zstd->ddict);
+	} else {
+		rc = ZSTD_decompressDCtx(zstd->dctx, dst, dsize, src, ssize);
+	}
+	if (ZSTD_isError(rc)) {
+		return -1;
+	}
+	return rc;
+}
@@ -18,6 +18,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/slab.h>
 
 #include "smashfs.h"
 
@@ -35,29 +36,42 @@
 #if defined(SMASHFS_ENABLE_XZ) && (SMASHFS_ENABLE_XZ == 1)
 #include "compressor-xz.h"
 #endif
+#if defined(SMASHFS_ENABLE_ZSTD) && (SMASHFS_ENABLE_ZSTD == 1)
+#include "compressor-zstd.h"
+#endif
+#if defined(SMASHFS_ENABLE_LZ4) && (SMASHFS_ENABLE_LZ4 == 1)
+#include "compressor-lz4.h"
+#endif
 
 struct compressor {
 	char *name;
 	enum smashfs_compression_type type;
 	void * (*create) (void);
 	void (*destroy) (void *context);
+	int (*dictionary) (void *context, const void *dictionary, unsigned int size);
 	int (*uncompress) (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize);
 	void *context;
 };
 
 struct compressor *compressors[] = {
-	& (struct compressor) { "none", smashfs_compression_type_none, NULL       , NULL        , none_uncompress },
+	& (struct compressor) { "none", smashfs_compression_type_none, NULL       , NULL        , NULL           , none_uncompress },
 #if defined(SMASHFS_ENABLE_GZIP) && (SMASHFS_ENABLE_GZIP == 1)
-	& (struct compressor) { "gzip", smashfs_compression_type_gzip, gzip_create, gzip_destroy, gzip_uncompress },
+	& (struct compressor) { "gzip", smashfs_compression_type_gzip, gzip_create, gzip_destroy, NULL           , gzip_uncompress },
 #endif
 #if defined(SMASHFS_ENABLE_LZMA) && (SMASHFS_ENABLE_LZMA == 1)
-	& (struct compressor) { "lzma", smashfs_compression_type_lzma, NULL       , NULL        , lzma_uncompress },
+	& (struct compressor) { "lzma", smashfs_compression_type_lzma, NULL       , NULL        , NULL           , lzma_uncompress },
 #endif
 #if defined(SMASHFS_ENABLE_LZO) && (SMASHFS_ENABLE_LZO == 1)
-	& (struct compressor) { "lzo" , smashfs_compression_type_lzo , NULL       , NULL        , lzo_uncompress  },
+	& (struct compressor) { "lzo" , smashfs_compression_type_lzo , NULL       , NULL        , NULL           , lzo_uncompress  },
 #endif
 #if defined(SMASHFS_ENABLE_XZ) && (SMASHFS_ENABLE_XZ == 1)
-	& (struct compressor) { "xz"  , smashfs_compression_type_xz  , NULL       , NULL        , xz_uncompress   },
+	& (struct compressor) { "xz"  , smashfs_compression_type_xz  , xz_create  , xz_destroy  , NULL           , xz_uncompress   },
+#endif
+#if defined(SMASHFS_ENABLE_ZSTD) && (SMASHFS_ENABLE_ZSTD == 1)
+	& (struct compressor) { "zstd", smashfs_compression_type_zstd, zstd_create, zstd_destroy, zstd_dictionary, zstd_uncompress },
+#endif
+#if defined(SMASHFS_ENABLE_LZ4) && (SMASHFS_ENABLE_LZ4 == 1)
+	& (struct compressor) { "lz4" , smashfs_compression_type_lz4 , NULL       , NULL        , NULL           , lz4_uncompress  },
 #endif
 	NULL
 };
@@ -65,16 +79,25 @@ struct compressor *compressors[] = {
 struct compressor * compressor_create_type (enum smashfs_compression_type type)
 {
 	struct compressor **c;
+	struct compressor *compressor;
 	for (c = compressors; *c; c++) {
-		if ((*c)->type == type) {
-			if ((*c)->create != NULL) {
-				(*c)->context = (*c)->create();
-				if ((*c)->context == NULL) {
-					continue;
-				}
+		if ((*c)->type != type) {
+			continue;
+		}
+		compressor = kmalloc(sizeof(struct compressor), GFP_KERNEL);
+		if (compressor == NULL) {
+			return NULL;
+		}
+		memcpy(compressor, *c, sizeof(struct compressor));
+		compressor->context = NULL;
+		if (compressor->create != NULL) {
+			compressor->context = compressor->create();
+			if (compressor->context == NULL) {
+				kfree(compressor);
+				return NULL;
 			}
-			return *c;
 		}
+		return compressor;
 	}
 	return NULL;
 }
@@ -98,6 +121,7 @@ int compressor_destroy (struct compressor *compressor)
 	if (compressor->destroy != NULL) {
 		compressor->destroy(compressor->context);
 	}
+	kfree(compressor);
 	return 0;
 }
 
@@ -106,6 +130,14 @@ enum smashfs_compression_type compressor_type (struct compressor *compressor)
 	return compressor->type;
 }
 
+int compressor_set_dictionary (struct compressor *compressor, const void *dictionary, unsigned int size)
+{
+	if (compressor->dictionary == NULL) {
+		return -1;
+	}
+	return compressor->dictionary(compressor->context, dictionary, size);
+}
+
 int compressor_uncompress (struct compressor *compressor, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	return compressor->uncompress(compressor->context, src, ssize, dst, dsize);
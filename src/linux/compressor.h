@@ -23,4 +23,5 @@ struct compressor * compressor_create_name (const char *name);
 struct compressor * compressor_create_type (enum smashfs_compression_type type);
 int compressor_destroy (struct compressor *compressor);
 enum smashfs_compression_type compressor_type (struct compressor *compressor);
+int compressor_set_dictionary (struct compressor *compressor, const void *dictionary, unsigned int size);
 int compressor_uncompress (struct compressor *compressor, void *src, unsigned int ssize, void *dst, unsigned int dsize);
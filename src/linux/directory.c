@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+
+#include "directory.h"
+
+struct directory {
+	struct list_head list;
+	struct directory **slot;
+	int refcount;
+	long long parent;
+	long long nentries;
+	struct directory_entry *entries;
+	char *data;
+};
+
+struct directory_cache {
+	spinlock_t lock;
+	struct list_head lru;
+	long long unused;
+	struct shrinker shrinker;
+};
+
+/*
+ * decoded directories hang off their inodes. the ones that are not being
+ * read are kept on the lru list, least recently used first, so memory
+ * pressure can take them away from inodes that stay in the icache.
+ */
+static inline void directory_cache_evict_locked (struct directory_cache *cache, struct directory *directory, struct list_head *evicted)
+{
+	list_move_tail(&directory->list, evicted);
+	*directory->slot = NULL;
+	directory->slot = NULL;
+	cache->unused -= 1;
+}
+
+static inline long long directory_cache_evict (struct directory_cache *cache, long long count)
+{
+	long long evicted;
+	struct list_head list;
+	struct directory *directory;
+	struct directory *ndirectory;
+	evicted = 0;
+	INIT_LIST_HEAD(&list);
+	spin_lock(&cache->lock);
+	while (evicted < count && !list_empty(&cache->lru)) {
+		directory = list_first_entry(&cache->lru, struct directory, list);
+		directory_cache_evict_locked(cache, directory, &list);
+		evicted += 1;
+	}
+	spin_unlock(&cache->lock);
+	list_for_each_entry_safe(directory, ndirectory, &list, list) {
+		list_del(&directory->list);
+		directory_free(directory);
+	}
+	return evicted;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,12,0)
+
+static int directory_cache_shrink (struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct directory_cache *cache;
+	cache = container_of(shrinker, struct directory_cache, shrinker);
+	if (sc->nr_to_scan > 0) {
+		directory_cache_evict(cache, sc->nr_to_scan);
+	}
+	return cache->unused;
+}
+
+#else
+
+static unsigned long directory_cache_shrink_count (struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct directory_cache *cache;
+	cache = container_of(shrinker, struct directory_cache, shrinker);
+	return cache->unused;
+}
+
+static unsigned long directory_cache_shrink_scan (struct shrinker *shrinker, struct shrink_control *sc)
+{
+	long long evicted;
+	struct directory_cache *cache;
+	cache = container_of(shrinker, struct directory_cache, shrinker);
+	evicted = directory_cache_evict(cache, sc->nr_to_scan);
+	return (evicted > 0) ? evicted : SHRINK_STOP;
+}
+
+#endif
+
+struct directory_cache * directory_cache_create (void)
+{
+	struct directory_cache *cache;
+	cache = kzalloc(sizeof(struct directory_cache), GFP_KERNEL);
+	if (cache == NULL) {
+		return NULL;
+	}
+	spin_lock_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->lru);
+	cache->unused = 0;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,12,0)
+	cache->shrinker.shrink = directory_cache_shrink;
+#else
+	cache->shrinker.count_objects = directory_cache_shrink_count;
+	cache->shrinker.scan_objects = directory_cache_shrink_scan;
+#endif
+	cache->shrinker.seeks = DEFAULT_SEEKS;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,12,0)
+	register_shrinker(&cache->shrinker);
+#else
+	if (register_shrinker(&cache->shrinker) != 0) {
+		kfree(cache);
+		return NULL;
+	}
+#endif
+	return cache;
+}
+
+void directory_cache_destroy (struct directory_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+	unregister_shrinker(&cache->shrinker);
+	directory_cache_evict(cache, LLONG_MAX);
+	kfree(cache);
+}
+
+/*
+ * returns a referenced directory from slot, or null if it is not decoded
+ * yet or was taken away by the shrinker.
+ */
+struct directory * directory_cache_get (struct directory_cache *cache, struct directory **slot)
+{
+	struct directory *directory;
+	spin_lock(&cache->lock);
+	directory = *slot;
+	if (directory != NULL) {
+		if (directory->refcount++ == 0) {
+			list_del_init(&directory->list);
+			cache->unused -= 1;
+		}
+	}
+	spin_unlock(&cache->lock);
+	return directory;
+}
+
+/*
+ * installs a freshly decoded directory into slot and returns it referenced.
+ * if another reader won the race, its directory is returned instead and
+ * ours is freed.
+ */
+struct directory * directory_cache_insert (struct directory_cache *cache, struct directory **slot, struct directory *directory)
+{
+	struct directory *odirectory;
+	odirectory = directory_cache_get(cache, slot);
+	if (odirectory != NULL) {
+		directory_free(directory);
+		return odirectory;
+	}
+	spin_lock(&cache->lock);
+	if (*slot != NULL) {
+		spin_unlock(&cache->lock);
+		directory_free(directory);
+		return directory_cache_get(cache, slot);
+	}
+	directory->slot = slot;
+	directory->refcount = 1;
+	*slot = directory;
+	spin_unlock(&cache->lock);
+	return directory;
+}
+
+void directory_cache_put (struct directory_cache *cache, struct directory *directory)
+{
+	int release;
+	release = 0;
+	spin_lock(&cache->lock);
+	if (--directory->refcount == 0) {
+		if (directory->slot != NULL) {
+			list_add_tail(&directory->list, &cache->lru);
+			cache->unused += 1;
+		} else {
+			release = 1;
+		}
+	}
+	spin_unlock(&cache->lock);
+	if (release) {
+		directory_free(directory);
+	}
+}
+
+/*
+ * detaches the directory of an inode that is going away. it is freed now if
+ * nobody is reading it, or by the last directory_cache_put otherwise.
+ */
+void directory_cache_release (struct directory_cache *cache, struct directory **slot)
+{
+	struct directory *directory;
+	spin_lock(&cache->lock);
+	directory = *slot;
+	if (directory == NULL) {
+		spin_unlock(&cache->lock);
+		return;
+	}
+	*slot = NULL;
+	directory->slot = NULL;
+	if (directory->refcount > 0) {
+		spin_unlock(&cache->lock);
+		return;
+	}
+	list_del_init(&directory->list);
+	cache->unused -= 1;
+	spin_unlock(&cache->lock);
+	directory_free(directory);
+}
+
+/*
+ * entries and raw directory data of size bytes share one allocation, names
+ * of the entries point into the raw data.
+ */
+struct directory * directory_alloc (long long parent, long long nentries, long long size)
+{
+	long long s;
+	struct directory *directory;
+	s  = sizeof(struct directory);
+	s += sizeof(struct directory_entry) * nentries;
+	s += size;
+	if (s > PAGE_SIZE) {
+		directory = vmalloc(s);
+	} else {
+		directory = kmalloc(s, GFP_KERNEL);
+	}
+	if (directory == NULL) {
+		return NULL;
+	}
+	INIT_LIST_HEAD(&directory->list);
+	directory->slot = NULL;
+	directory->refcount = 0;
+	directory->parent = parent;
+	directory->nentries = nentries;
+	directory->entries = (struct directory_entry *) (directory + 1);
+	directory->data = (char *) (directory->entries + nentries);
+	return directory;
+}
+
+void directory_free (struct directory *directory)
+{
+	if (is_vmalloc_addr(directory)) {
+		vfree(directory);
+	} else {
+		kfree(directory);
+	}
+}
+
+long long directory_parent (struct directory *directory)
+{
+	return directory->parent;
+}
+
+long long directory_nentries (struct directory *directory)
+{
+	return directory->nentries;
+}
+
+struct directory_entry * directory_entry (struct directory *directory, long long e)
+{
+	return &directory->entries[e];
+}
+
+void * directory_data (struct directory *directory)
+{
+	return directory->data;
+}
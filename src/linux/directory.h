@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+struct directory;
+struct directory_cache;
+
+struct directory_entry {
+	long long number;
+	long long type;
+	long long length;
+	char *name;
+};
+
+struct directory_cache * directory_cache_create (void);
+void directory_cache_destroy (struct directory_cache *cache);
+struct directory * directory_cache_get (struct directory_cache *cache, struct directory **slot);
+struct directory * directory_cache_insert (struct directory_cache *cache, struct directory **slot, struct directory *directory);
+void directory_cache_put (struct directory_cache *cache, struct directory *directory);
+void directory_cache_release (struct directory_cache *cache, struct directory **slot);
+
+struct directory * directory_alloc (long long parent, long long nentries, long long size);
+void directory_free (struct directory *directory);
+long long directory_parent (struct directory *directory);
+long long directory_nentries (struct directory *directory);
+struct directory_entry * directory_entry (struct directory *directory, long long e);
+void * directory_data (struct directory *directory);
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+
+#include "smashfs.h"
+#include "compressor.h"
+#include "pool.h"
+
+struct pool_stream {
+	struct list_head list;
+	struct compressor *compressor;
+	void *buffer;
+};
+
+struct pool {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct list_head streams;
+	enum smashfs_compression_type type;
+	const void *dictionary;
+	unsigned int dictionary_size;
+	int nstreams;
+	int max_streams;
+	long long buffer_size;
+};
+
+static inline void pool_stream_destroy (struct pool_stream *stream)
+{
+	if (stream == NULL) {
+		return;
+	}
+	if (stream->compressor != NULL) {
+		compressor_destroy(stream->compressor);
+	}
+	if (stream->buffer != NULL) {
+		vfree(stream->buffer);
+	}
+	kfree(stream);
+}
+
+static inline struct pool_stream * pool_stream_create (struct pool *pool)
+{
+	struct pool_stream *stream;
+	stream = kzalloc(sizeof(struct pool_stream), GFP_KERNEL);
+	if (stream == NULL) {
+		return NULL;
+	}
+	INIT_LIST_HEAD(&stream->list);
+	stream->compressor = compressor_create_type(pool->type);
+	if (stream->compressor == NULL) {
+		goto bail;
+	}
+	if (pool->dictionary != NULL) {
+		if (compressor_set_dictionary(stream->compressor, pool->dictionary, pool->dictionary_size) != 0) {
+			goto bail;
+		}
+	}
+	stream->buffer = vmalloc(pool->buffer_size);
+	if (stream->buffer == NULL) {
+		goto bail;
+	}
+	return stream;
+bail:
+	pool_stream_destroy(stream);
+	return NULL;
+}
+
+/*
+ * streams are created on demand up to max_streams, so a mount only pays for
+ * as many decompressor contexts and block buffers as it has parallel readers.
+ * the first stream is created with the pool, so mount fails early if the
+ * compressor is not available. every stream references the dictionary, if
+ * any, which must outlive the pool.
+ */
+struct pool * pool_create (enum smashfs_compression_type type, const void *dictionary, unsigned int dictionary_size, int nstreams, long long buffer_size)
+{
+	struct pool *pool;
+	struct pool_stream *stream;
+	pool = kzalloc(sizeof(struct pool), GFP_KERNEL);
+	if (pool == NULL) {
+		return NULL;
+	}
+	spin_lock_init(&pool->lock);
+	init_waitqueue_head(&pool->wait);
+	INIT_LIST_HEAD(&pool->streams);
+	pool->type = type;
+	pool->dictionary = dictionary;
+	pool->dictionary_size = dictionary_size;
+	pool->nstreams = 0;
+	pool->max_streams = max(nstreams, 1);
+	pool->buffer_size = buffer_size;
+	stream = pool_stream_create(pool);
+	if (stream == NULL) {
+		kfree(pool);
+		return NULL;
+	}
+	list_add(&stream->list, &pool->streams);
+	pool->nstreams = 1;
+	return pool;
+}
+
+void pool_destroy (struct pool *pool)
+{
+	struct pool_stream *stream;
+	struct pool_stream *nstream;
+	if (pool == NULL) {
+		return;
+	}
+	list_for_each_entry_safe(stream, nstream, &pool->streams, list) {
+		list_del(&stream->list);
+		pool_stream_destroy(stream);
+	}
+	kfree(pool);
+}
+
+struct pool_stream * pool_get (struct pool *pool)
+{
+	struct pool_stream *stream;
+	while (1) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->streams)) {
+			stream = list_first_entry(&pool->streams, struct pool_stream, list);
+			list_del_init(&stream->list);
+			spin_unlock(&pool->lock);
+			return stream;
+		}
+		if (pool->nstreams < pool->max_streams) {
+			pool->nstreams += 1;
+			spin_unlock(&pool->lock);
+			stream = pool_stream_create(pool);
+			if (stream != NULL) {
+				return stream;
+			}
+			spin_lock(&pool->lock);
+			pool->nstreams -= 1;
+			pool->max_streams = max(pool->nstreams, 1);
+			spin_unlock(&pool->lock);
+			continue;
+		}
+		spin_unlock(&pool->lock);
+		wait_event(pool->wait, !list_empty(&pool->streams));
+	}
+}
+
+void pool_put (struct pool *pool, struct pool_stream *stream)
+{
+	spin_lock(&pool->lock);
+	list_add(&stream->list, &pool->streams);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+}
+
+struct compressor * pool_stream_compressor (struct pool_stream *stream)
+{
+	return stream->compressor;
+}
+
+void * pool_stream_buffer (struct pool_stream *stream)
+{
+	return stream->buffer;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+struct pool;
+struct pool_stream;
+
+struct pool * pool_create (enum smashfs_compression_type type, const void *dictionary, unsigned int dictionary_size, int nstreams, long long buffer_size);
+void pool_destroy (struct pool *pool);
+struct pool_stream * pool_get (struct pool *pool);
+void pool_put (struct pool *pool, struct pool_stream *stream);
+struct compressor * pool_stream_compressor (struct pool_stream *stream);
+void * pool_stream_buffer (struct pool_stream *stream);
@@ -20,15 +20,20 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/pagemap.h>
 #include <linux/buffer_head.h>
 #include <linux/statfs.h>
 #include <linux/namei.h>
+#include <linux/parser.h>
 #include <linux/version.h>
 
 #include "smashfs.h"
 #include "bitbuffer.h"
 #include "compressor.h"
+#include "cache.h"
+#include "directory.h"
+#include "pool.h"
 #include "super.h"
 
 #define errorf(a...) { \
@@ -51,10 +56,15 @@
 	debugf("leave (%s %s:%d)\n", __FUNCTION__, __FILE__, __LINE__); \
 }
 
+#define DEFAULT_CACHE_SIZE	(8 * 1024 * 1024)
+
 struct block {
 	long long offset;
 	long long size;
 	long long compressed_size;
+	long long stored;
+	long long type;
+	long long bcj;
 };
 
 struct node {
@@ -70,10 +80,13 @@ struct node {
 	long long size;
 	long long block;
 	long long index;
+	long long extents;
+	unsigned char *extent;
 };
 
 struct node_info {
 	struct node node;
+	struct directory *directory;
 	struct inode inode;
 };
 
@@ -83,7 +96,6 @@ static const struct inode_operations smashfs_dir_inode_operations;
 static const struct address_space_operations smashfs_aops;
 
 static struct kmem_cache *smashfs_inode_cachep			= NULL;
-static struct kmem_cache *smashfs_block_cachep			= NULL;
 
 static inline void inodecache_init_once (void *foo)
 {
@@ -106,20 +118,6 @@ static inline void destroy_inodecache (void)
 	}
 }
 
-static inline int init_blockcache (size_t size)
-{
-	smashfs_block_cachep = kmem_cache_create("smashfs_block_cache", size, 0, SLAB_HWCACHE_ALIGN | SLAB_RECLAIM_ACCOUNT, NULL);
-	return smashfs_block_cachep ? 0 : -ENOMEM;
-}
-
-
-static inline void destroy_blockcache (void)
-{
-	if (smashfs_block_cachep != NULL) {
-		kmem_cache_destroy(smashfs_block_cachep);
-	}
-}
-
 static inline struct node_info * smashfs_i (struct inode *inode)
 {
 	return container_of(inode, struct node_info, inode);
@@ -148,6 +146,9 @@ static inline int block_fill (struct super_block *sb, long long number, struct b
 	bitbuffer_setpos(&bb, number * sbi->max_block_size);
 	block->offset           = bitbuffer_getbits(&bb, sbi->super->bits.block.offset);
 	block->compressed_size  = bitbuffer_getbits(&bb, sbi->super->bits.block.compressed_size) + sbi->super->min.block.compressed_size;
+	block->stored           = bitbuffer_getbits(&bb, sbi->super->bits.block.stored);
+	block->type             = (sbi->super->bits.block.type > 0) ? bitbuffer_getbits(&bb, sbi->super->bits.block.type) : sbi->super->compression_type;
+	block->bcj              = bitbuffer_getbits(&bb, sbi->super->bits.block.bcj);
 	block->size             = (number + 1 < sbi->super->blocks) ? sbi->super->block_size : bitbuffer_getbits(&bb, sbi->super->bits.block.size);
 	bitbuffer_uninit(&bb);
 
@@ -155,6 +156,9 @@ static inline int block_fill (struct super_block *sb, long long number, struct b
 	debugf("  number: %lld\n", number);
 	debugf("  offset: %lld\n", block->offset);
 	debugf("  csize : %lld\n", block->compressed_size);
+	debugf("  stored: %lld\n", block->stored);
+	debugf("  type  : %lld\n", block->type);
+	debugf("  bcj   : %lld\n", block->bcj);
 	debugf("  size  : %lld\n", block->size);
 
 	leavef();
@@ -194,6 +198,8 @@ static inline int node_fill (struct super_block *sb, long long number, struct no
 	node->size       = bitbuffer_getbits(&bb, sbi->super->bits.inode.size);
 	node->block      = bitbuffer_getbits(&bb, sbi->super->bits.inode.block);
 	node->index      = bitbuffer_getbits(&bb, sbi->super->bits.inode.index);
+	node->extents    = bitbuffer_getbits(&bb, sbi->super->bits.inode.extents);
+	node->extent     = NULL;
 	bitbuffer_uninit(&bb);
 
 	if (sbi->super->bits.inode.group_mode == 0) {
@@ -221,11 +227,14 @@ static inline int node_fill (struct super_block *sb, long long number, struct no
 	debugf("  number: %lld\n", node->number);
 	debugf("  type  : %lld\n", node->type);
 	debugf("  size  : %lld\n", node->size);
+	debugf("  extents: %lld\n", node->extents);
 
 	leavef();
 	return 0;
 }
 
+static inline int node_extents_read (struct super_block *sb, struct node *node);
+
 static inline int smashfs_read_inode (struct super_block *sb, struct inode *inode, long long number)
 {
 	int rc;
@@ -305,6 +314,15 @@ static inline int smashfs_read_inode (struct super_block *sb, struct inode *inod
 	inode->i_mtime.tv_sec = node.mtime;
 	inode->i_atime.tv_sec = node.mtime;
 
+	if (node.type == smashfs_inode_type_regular_file && node.extents > 0) {
+		rc = node_extents_read(sb, &node);
+		if (rc != 0) {
+			errorf("node extents read failed\n");
+			leavef();
+			return rc;
+		}
+	}
+
 	node_info = smashfs_i(inode);
 	memcpy(&node_info->node, &node, sizeof(struct node));
 
@@ -455,92 +473,194 @@ static inline int smashfs_read (struct super_block *sb, void *buffer, int offset
 	return length;
 }
 
-static inline int node_read (struct super_block *sb, struct node *node, int (*function) (void *context, void *buffer, long long size), void *context, long long offset, long long size)
+static int block_read (void *context, long long number, void *buffer, long long size)
+{
+	int rc;
+	struct pool *pool;
+	struct block block;
+	struct super_block *sb;
+	struct pool_stream *stream;
+	struct smashfs_super_info *sbi;
+
+	enterf();
+
+	sb = context;
+	sbi = sb->s_fs_info;
+
+	rc = block_fill(sb, number, &block);
+	if (rc != 0) {
+		errorf("block fill failed\n");
+		leavef();
+		return -EIO;
+	}
+	if (block.size > size ||
+	    block.compressed_size > sbi->super->block_size) {
+		errorf("logic error\n");
+		leavef();
+		return -EIO;
+	}
+
+	if (block.stored && block.compressed_size == 0) {
+		memset(buffer, 0, block.size);
+		leavef();
+		return block.size;
+	}
+
+	if (block.stored) {
+		if (block.compressed_size != block.size) {
+			errorf("logic error\n");
+			leavef();
+			return -EIO;
+		}
+		rc = smashfs_read(sb, buffer, sbi->super->entries_offset + block.offset, block.size);
+		if (rc != block.size) {
+			errorf("read block failed");
+			leavef();
+			return -EIO;
+		}
+		leavef();
+		return block.size;
+	}
+
+	pool = (block.type < SMASHFS_COMPRESSION_TYPES) ? sbi->pools[block.type] : NULL;
+	if (pool == NULL) {
+		errorf("no pool for compression type: %lld\n", block.type);
+		leavef();
+		return -EIO;
+	}
+	stream = pool_get(pool);
+	rc = smashfs_read(sb, pool_stream_buffer(stream), sbi->super->entries_offset + block.offset, block.compressed_size);
+	if (rc != block.compressed_size) {
+		errorf("read block failed");
+		pool_put(pool, stream);
+		leavef();
+		return -EIO;
+	}
+	rc = compressor_uncompress(pool_stream_compressor(stream), pool_stream_buffer(stream), block.compressed_size, buffer, block.size);
+	pool_put(pool, stream);
+	if (rc != block.size) {
+		errorf("uncompress failed");
+		leavef();
+		return -EIO;
+	}
+
+	leavef();
+	return block.size;
+}
+
+static inline int entries_read (struct super_block *sb, int (*function) (void *context, void *buffer, long long size), void *context, long long offset, long long size)
 {
 	int rc;
 	long long s;
 	long long i;
 	long long b;
 	long long n;
-	long long o;
 	long long l;
-	void *ubuffer;
-	void *cbuffer;
-	struct block block;
+	struct cache_entry *entry;
 	struct smashfs_super_info *sbi;
 
 	enterf();
-	debugf("offset: %lld, size: %lld\n", offset, size);
-
-	ubuffer = NULL;
-	cbuffer = NULL;
 
 	sbi = sb->s_fs_info;
 
-	ubuffer = kmem_cache_alloc(smashfs_block_cachep, GFP_NOIO);
-	if (ubuffer == NULL) {
-		errorf("malloc failed\n");
-		goto bail;
-	}
-	cbuffer = kmem_cache_alloc(smashfs_block_cachep, GFP_NOIO);
-	if (cbuffer == NULL) {
-		errorf("malloc failed\n");
-		kmem_cache_free(smashfs_block_cachep, ubuffer);
-		goto bail;
-	}
-
-	o = offset + node->index + (node->block * sbi->super->block_size);
-	i = o & ((1 << sbi->super->block_log2) - 1);
-	b = o >> sbi->super->block_log2;
+	i = offset & ((1 << sbi->super->block_log2) - 1);
+	b = offset >> sbi->super->block_log2;
 	n = ((size + sbi->super->block_size - 1) >> sbi->super->block_log2) + 1;
 	debugf("offset: %lld, index: %lld, block: %lld, blocks: %lld\n", offset, i, b, n);
 
 	s = 0;
 	while (s < size) {
-		rc = block_fill(sb, b, &block);
-		if (rc != 0) {
-			errorf("block fill failed\n");
-			goto bail;
+		entry = cache_get(sbi->cache, b);
+		if (IS_ERR(entry)) {
+			errorf("cache get failed\n");
+			leavef();
+			return -1;
 		}
-		if (block.size > sbi->super->block_size) {
+		if (cache_entry_size(entry) <= i) {
 			errorf("logic error\n");
-			goto bail;
-		}
-
-		rc = smashfs_read(sb, cbuffer, sbi->super->entries_offset + block.offset, block.compressed_size);
-		if (rc != block.compressed_size) {
-			errorf("read block failed");
-			goto bail;
-		}
-		rc = compressor_uncompress(sbi->compressor, cbuffer, block.compressed_size, ubuffer, block.size);
-		if (rc != block.size) {
-			errorf("uncompress failed");
-			goto bail;
+			cache_put(sbi->cache, entry);
+			leavef();
+			return -1;
 		}
 
-		l = min_t(long long, size - s, block.size - i);
-		rc = function(context, ubuffer + i, l);
+		l = min_t(long long, size - s, cache_entry_size(entry) - i);
+		rc = function(context, cache_entry_buffer(entry) + i, l);
+		cache_put(sbi->cache, entry);
 		if (rc != l) {
 			errorf("function failed\n");
-			goto bail;
+			leavef();
+			return -1;
 		}
 		s += l;
 		b += 1;
 		i = 0;
 	}
 
-	kmem_cache_free(smashfs_block_cachep, cbuffer);
-	kmem_cache_free(smashfs_block_cachep, ubuffer);
 	leavef();
 	return 0;
-bail:	if (cbuffer != NULL) {
-		kmem_cache_free(smashfs_block_cachep, cbuffer);
+}
+
+/*
+ * reads size bytes at offset of node. a split file is the concatenation
+ * of its extents, only the extents overlapping the range are read.
+ */
+static inline int node_read (struct super_block *sb, struct node *node, int (*function) (void *context, void *buffer, long long size), void *context, long long offset, long long size)
+{
+	int rc;
+	long long e;
+	long long l;
+	long long start;
+	long long length;
+	long long position;
+	struct bitbuffer bb;
+	struct smashfs_super_info *sbi;
+
+	enterf();
+	debugf("offset: %lld, size: %lld\n", offset, size);
+
+	sbi = sb->s_fs_info;
+
+	if (node->extents == 0) {
+		rc = entries_read(sb, function, context, offset + node->index + (node->block * sbi->super->block_size), size);
+		leavef();
+		return rc;
+	}
+
+	rc = bitbuffer_init_from_buffer(&bb, node->extent, node->extents * SMASHFS_EXTENT_SIZE);
+	if (rc != 0) {
+		errorf("bitbuffer init from buffer failed\n");
+		leavef();
+		return -1;
+	}
+	start = 0;
+	for (e = 0; e < node->extents && size > 0; e++) {
+		position = bitbuffer_getbits(&bb, 32);
+		length   = bitbuffer_getbits(&bb, 32);
+		if (offset >= start + length) {
+			start += length;
+			continue;
+		}
+		l = min_t(long long, size, start + length - offset);
+		debugf("extent: %lld, position: %lld, length: %lld\n", e, position, length);
+		rc = entries_read(sb, function, context, position + (offset - start), l);
+		if (rc != 0) {
+			bitbuffer_uninit(&bb);
+			leavef();
+			return rc;
+		}
+		offset += l;
+		size -= l;
+		start += length;
 	}
-	if (ubuffer != NULL) {
-		kmem_cache_free(smashfs_block_cachep, ubuffer);
+	bitbuffer_uninit(&bb);
+	if (size > 0) {
+		errorf("read past extents\n");
+		leavef();
+		return -1;
 	}
+
 	leavef();
-	return -1;
+	return 0;
 }
 
 static inline int node_read_directory (void *context, void *buffer, long long size)
@@ -585,219 +705,390 @@ static inline int node_read_regular_file (void *context, void *buffer, long long
 	return size;
 }
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-static int smashfs_readdir (struct file *file, void *dirent, filldir_t filldir)
-#else
-static inline int smashfs_readdir (struct file *file, struct dir_context *dirent)
-#endif
+static inline int node_read_buffer (struct super_block *sb, struct node *node, void *buffer, long long offset, long long size)
+{
+	char *b;
+	b = buffer;
+	return node_read(sb, node, node_read_directory, &b, offset, size);
+}
+
+/*
+ * entry of a split file is its extent map, kept with the inode as long as
+ * the inode lives.
+ */
+static inline int node_extents_read (struct super_block *sb, struct node *node)
 {
 	int rc;
+	char *b;
+	unsigned char *extent;
+	struct smashfs_super_info *sbi;
 
-	struct node *node;
+	enterf();
+
+	sbi = sb->s_fs_info;
+
+	extent = kmalloc(node->extents * SMASHFS_EXTENT_SIZE, GFP_KERNEL);
+	if (extent == NULL) {
+		errorf("kmalloc failed for extents\n");
+		leavef();
+		return -ENOMEM;
+	}
+	b = (char *) extent;
+	rc = entries_read(sb, node_read_directory, &b, node->index + (node->block * sbi->super->block_size), node->extents * SMASHFS_EXTENT_SIZE);
+	if (rc != 0) {
+		errorf("entries read failed for extents\n");
+		kfree(extent);
+		leavef();
+		return -EIO;
+	}
+	node->extent = extent;
+
+	leavef();
+	return 0;
+}
 
+/*
+ * decodes the whole directory of inode once, and keeps it on the inode
+ * until the inode is evicted or the shrinker takes it away. returns a
+ * referenced directory, release with directory_cache_put.
+ */
+static inline struct directory * directory_get (struct super_block *sb, struct inode *inode)
+{
+	int rc;
 	char *buffer;
-	char *nbuffer;
+	unsigned char header[16];
 	struct bitbuffer bb;
-
-	struct inode *inode;
-	struct super_block *sb;
+	struct node *node;
+	struct directory *directory;
+	struct directory_entry *entry;
 	struct smashfs_super_info *sbi;
 
 	long long e;
-	long long s;
+	long long hsize;
+	long long isize;
+	long long esize;
+	long long offset;
 	long long directory_parent;
 	long long directory_nentries;
-	long long directory_entry_number;
-	long long directory_entry_length;
-	long long directory_entry_type;
 
 	enterf();
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-	debugf("file->f_pos: %lld\n", file->f_pos);
-#else
-	debugf("dirent->pos: %lld\n", dirent->pos);
-#endif
-
-	nbuffer = NULL;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-	inode = file->f_path.dentry->d_inode;
-#else
-	inode = file_inode(file);
-#endif
-	sb = inode->i_sb;
 	sbi = sb->s_fs_info;
-
 	node = &(smashfs_i(inode)->node);
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-	if (file->f_pos >= 3 + node->size) {
-		debugf("finished reading (%lld, %lld)\n", file->f_pos, node->size);
-#else
-	if (dirent->pos >= 3 + node->size) {
-		debugf("finished reading (%lld, %lld)\n", dirent->pos, node->size);
-#endif
+	directory = directory_cache_get(sbi->directories, &(smashfs_i(inode)->directory));
+	if (directory != NULL) {
 		leavef();
-		return 0;
+		return directory;
 	}
 
-	nbuffer = kmalloc(node->size, GFP_KERNEL);
-	if (nbuffer == NULL) {
-		errorf("kmalloc failed\n");
+	hsize  = 0;
+	hsize += sbi->super->bits.inode.directory.parent;
+	hsize += sbi->super->bits.inode.directory.nentries;
+	hsize  = (hsize + 7) / 8;
+	isize  = (sbi->super->bits.inode.directory.index + 7) / 8;
+	esize  = 0;
+	esize += sbi->super->bits.inode.directory.entries.number;
+	esize += sbi->super->bits.inode.directory.entries.length;
+	esize += sbi->super->bits.inode.directory.entries.type;
+	esize  = (esize + 7) / 8;
+
+	rc = node_read_buffer(sb, node, header, 0, hsize);
+	if (rc != 0) {
+		errorf("node read failed\n");
 		leavef();
-		return -ENOMEM;
+		return ERR_PTR(-EIO);
+	}
+	bitbuffer_init_from_buffer(&bb, header, hsize);
+	directory_parent   = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.parent);
+	directory_nentries = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.nentries);
+	bitbuffer_uninit(&bb);
+
+	debugf("number: %lld, parent: %lld, nentries: %lld\n", node->number, directory_parent, directory_nentries);
+
+	if (hsize + (isize + esize) * directory_nentries > node->size) {
+		errorf("invalid directory entries: %lld\n", directory_nentries);
+		leavef();
+		return ERR_PTR(-EIO);
 	}
 
-	buffer = nbuffer;
+	directory = directory_alloc(directory_parent, directory_nentries, node->size);
+	if (directory == NULL) {
+		errorf("directory alloc failed\n");
+		leavef();
+		return ERR_PTR(-ENOMEM);
+	}
+	buffer = directory_data(directory);
 	rc = node_read(sb, node, node_read_directory, &buffer, 0, node->size);
 	if (rc != 0) {
 		errorf("node read failed\n");
-		kfree(nbuffer);
+		directory_free(directory);
 		leavef();
-		return -EIO;
+		return ERR_PTR(-EIO);
 	}
 
-	buffer = nbuffer;
-	bitbuffer_init_from_buffer(&bb, buffer, node->size);
-	directory_parent   = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.parent);
-	directory_nentries = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.nentries);
-	bitbuffer_uninit(&bb);
+	buffer = directory_data(directory);
+	offset = hsize + isize * directory_nentries;
+	for (e = 0; e < directory_nentries; e++) {
+		if (offset + esize > node->size) {
+			errorf("invalid directory entry offset: %lld\n", offset);
+			directory_free(directory);
+			leavef();
+			return ERR_PTR(-EIO);
+		}
+		entry = directory_entry(directory, e);
+		bitbuffer_init_from_buffer(&bb, buffer + offset, esize);
+		entry->number = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.number);
+		entry->length = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.length);
+		entry->type   = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.type);
+		bitbuffer_uninit(&bb);
+		entry->name   = buffer + offset + esize;
+		offset += esize + entry->length;
+		if (offset > node->size) {
+			errorf("invalid directory entry length: %lld\n", entry->length);
+			directory_free(directory);
+			leavef();
+			return ERR_PTR(-EIO);
+		}
+	}
+
+	directory = directory_cache_insert(sbi->directories, &(smashfs_i(inode)->directory), directory);
+	leavef();
+	return directory;
+}
+
+/*
+ * binary searches a decoded directory, returns the inode number of name or
+ * -1 if it is not there.
+ */
+static inline long long directory_lookup (struct directory *directory, const char *name, unsigned int length)
+{
+	int rc;
+	long long l;
+	long long h;
+	long long m;
+	struct directory_entry *entry;
+
+	l = 0;
+	h = directory_nentries(directory) - 1;
+	while (l <= h) {
+		m = l + (h - l) / 2;
+		entry = directory_entry(directory, m);
+		rc = memcmp(name, entry->name, min_t(long long, length, entry->length));
+		if (rc == 0) {
+			if (length == entry->length) {
+				return entry->number;
+			}
+			rc = (length < entry->length) ? -1 : 1;
+		}
+		if (rc < 0) {
+			h = m - 1;
+		} else {
+			l = m + 1;
+		}
+	}
+	return -1;
+}
+
+static inline unsigned char directory_entry_dtype (long long type)
+{
+	return (type == smashfs_inode_type_regular_file) ? DT_REG :
+	       (type == smashfs_inode_type_directory) ? DT_DIR :
+	       (type == smashfs_inode_type_symbolic_link) ? DT_LNK :
+	       (type == smashfs_inode_type_character_device) ? DT_CHR :
+	       (type == smashfs_inode_type_block_device) ? DT_BLK :
+	       (type == smashfs_inode_type_fifo) ? DT_FIFO :
+	       (type == smashfs_inode_type_socket) ? DT_SOCK : DT_UNKNOWN;
+}
 
+/*
+ * position 0 is ".", 1 is "..", and 2 + e is entry e of the decoded
+ * directory, so a getdents call resumes right where the previous one
+ * stopped.
+ */
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-	while (file->f_pos < 3) {
+static int smashfs_readdir (struct file *file, void *dirent, filldir_t filldir)
 #else
-	while (dirent->pos < 3) {
+static inline int smashfs_readdir (struct file *file, struct dir_context *dirent)
 #endif
-		int i_ino;
-		char *name;
+{
+	loff_t *pos;
+
+	struct inode *inode;
+	struct super_block *sb;
+	struct smashfs_super_info *sbi;
+	struct directory *directory;
+	struct directory_entry *entry;
+
+	long long e;
+	long long nentries;
+
+	enterf();
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-		if (file->f_pos == 0) {
+	inode = file->f_path.dentry->d_inode;
+	pos = &file->f_pos;
 #else
-		if (dirent->pos == 0) {
+	inode = file_inode(file);
+	pos = &dirent->pos;
 #endif
+	sb = inode->i_sb;
+	sbi = sb->s_fs_info;
+
+	debugf("pos: %lld\n", *pos);
+
+	directory = directory_get(sb, inode);
+	if (IS_ERR(directory)) {
+		errorf("directory get failed\n");
+		leavef();
+		return PTR_ERR(directory);
+	}
+	nentries = directory_nentries(directory);
+
+	while (*pos < 2) {
+		int s;
+		int i_ino;
+		char *name;
+		if (*pos == 0) {
 			name = ".";
 			s = 1;
 			i_ino = inode->i_ino;
 		} else {
 			name = "..";
 			s = 2;
-			i_ino = directory_parent + 1;
+			i_ino = directory_parent(directory) + 1;
 		}
-		debugf("calling filldir(%p, %s, %lld, %lld, %d, %d)\n", dirent, name, s, file->f_pos, i_ino, DT_DIR);
+		debugf("calling filldir(%p, %s, %d, %lld, %d, %d)\n", dirent, name, s, *pos, i_ino, DT_DIR);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-		if (filldir(dirent, name, s, file->f_pos, i_ino, DT_DIR) < 0) {
+		if (filldir(dirent, name, s, *pos, i_ino, DT_DIR) < 0) {
 #else
 		if (dir_emit(dirent, name, s, i_ino, DT_DIR) == 0) {
 #endif
 			debugf("filldir failed\n");
-			kfree(nbuffer);
-			leavef();
-			return 0;
+			goto out;
 		}
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-		file->f_pos += s;
-#else
-		dirent->pos += s;
-#endif
+		*pos += 1;
 	}
 
-	debugf("number: %lld, parent: %lld, nentries: %lld\n", node->number, directory_parent, directory_nentries);
-	s  = 0;
-	s += sbi->super->bits.inode.directory.parent;
-	s += sbi->super->bits.inode.directory.nentries;
-	s  = (s + 7) / 8;
-	buffer += s;
+	for (e = *pos - 2; e < nentries; e++) {
+		entry = directory_entry(directory, e);
+		debugf("  - %lld, pos: %lld\n", entry->number, *pos);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-	if (file->f_pos < 3 + s) {
-		file->f_pos += s;
-	}
+		if (filldir(dirent, entry->name, entry->length, *pos, entry->number + 1, directory_entry_dtype(entry->type)) < 0) {
 #else
-	if (dirent->pos < 3 + s) {
-		dirent->pos += s;
-	}
+		if (dir_emit(dirent, entry->name, entry->length, entry->number + 1, directory_entry_dtype(entry->type)) == 0) {
 #endif
+			debugf("filldir failed\n");
+			goto out;
+		}
+		*pos += 1;
+	}
 
-	for (e = 0; e < directory_nentries; e++) {
-		s  = 0;
-		s += sbi->super->bits.inode.directory.entries.number;
-		s += sbi->super->bits.inode.directory.entries.length;
-		s += sbi->super->bits.inode.directory.entries.type;
-		s  = (s + 7) / 8;
-
-		bitbuffer_init_from_buffer(&bb, buffer, s);
-		directory_entry_number = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.number);
-		directory_entry_length = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.length);
-		directory_entry_type = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.type);
-		bitbuffer_uninit(&bb);
+out:
+	directory_cache_put(sbi->directories, directory);
+	leavef();
+	return 0;
+}
 
-		buffer += s;
+/*
+ * reads entry e of a directory through the entry offsets index. only the
+ * blocks that hold the index slot and the entry itself are decompressed.
+ */
+static inline int directory_entry_read (struct super_block *sb, struct node *node, long long nentries, long long e, long long *number, long long *type, char *name, long long *length)
+{
+	int rc;
+	long long s;
+	long long hsize;
+	long long isize;
+	long long esize;
+	long long offset;
+	struct bitbuffer bb;
+	unsigned char buffer[24 + SMASHFS_NAME_LEN];
+	struct smashfs_super_info *sbi;
 
-		debugf("  - %lld, f_pos: %lld, %zd\n", directory_entry_number, file->f_pos, ((buffer - s) - nbuffer) + 3);
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-		if (file->f_pos == ((buffer - s) - nbuffer) + 3) {
-#else
-		if (dirent->pos == ((buffer - s) - nbuffer) + 3) {
-#endif
-			debugf("    calling filldir(%p, %lld, %lld, %lld, %s)\n",
-				dirent,
-				directory_entry_length,
-				file->f_pos,
-				directory_entry_number + 1,
-				(directory_entry_type == smashfs_inode_type_regular_file) ? "DT_REG" :
-				(directory_entry_type == smashfs_inode_type_directory) ? "DT_DIR" :
-				(directory_entry_type == smashfs_inode_type_symbolic_link) ? "DT_LNK" :
-				(directory_entry_type == smashfs_inode_type_character_device) ? "DT_CHR" :
-				(directory_entry_type == smashfs_inode_type_block_device) ? "DT_BLK" :
-				(directory_entry_type == smashfs_inode_type_fifo) ? "DT_FIFO" :
-				(directory_entry_type == smashfs_inode_type_socket) ? "DT_SOCK" : "DT_UNKNOWN");
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-			if (filldir(dirent,
-				    buffer,
-				    directory_entry_length,
-				    file->f_pos,
-				    directory_entry_number + 1,
-				    (directory_entry_type == smashfs_inode_type_regular_file) ? DT_REG :
-				    (directory_entry_type == smashfs_inode_type_directory) ? DT_DIR :
-				    (directory_entry_type == smashfs_inode_type_symbolic_link) ? DT_LNK :
-				    (directory_entry_type == smashfs_inode_type_character_device) ? DT_CHR :
-				    (directory_entry_type == smashfs_inode_type_block_device) ? DT_BLK :
-				    (directory_entry_type == smashfs_inode_type_fifo) ? DT_FIFO :
-				    (directory_entry_type == smashfs_inode_type_socket) ? DT_SOCK : DT_UNKNOWN) < 0) {
-#else
-			if (dir_emit(dirent,
-				    buffer,
-				    directory_entry_length,
-				    directory_entry_number + 1,
-				    (directory_entry_type == smashfs_inode_type_regular_file) ? DT_REG :
-				    (directory_entry_type == smashfs_inode_type_directory) ? DT_DIR :
-				    (directory_entry_type == smashfs_inode_type_symbolic_link) ? DT_LNK :
-				    (directory_entry_type == smashfs_inode_type_character_device) ? DT_CHR :
-				    (directory_entry_type == smashfs_inode_type_block_device) ? DT_BLK :
-				    (directory_entry_type == smashfs_inode_type_fifo) ? DT_FIFO :
-				    (directory_entry_type == smashfs_inode_type_socket) ? DT_SOCK : DT_UNKNOWN) == 0) {
-#endif
-				debugf("filldir failed\n");
-				kfree(nbuffer);
-				leavef();
-				return 0;
-			}
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-			file->f_pos += s;
-			file->f_pos += directory_entry_length;
-#else
-			dirent->pos += s;
-			dirent->pos += directory_entry_length;
-#endif
-		}
+	enterf();
 
-		buffer += directory_entry_length;
+	sbi = sb->s_fs_info;
+
+	hsize  = 0;
+	hsize += sbi->super->bits.inode.directory.parent;
+	hsize += sbi->super->bits.inode.directory.nentries;
+	hsize  = (hsize + 7) / 8;
+	isize  = (sbi->super->bits.inode.directory.index + 7) / 8;
+	esize  = 0;
+	esize += sbi->super->bits.inode.directory.entries.number;
+	esize += sbi->super->bits.inode.directory.entries.length;
+	esize += sbi->super->bits.inode.directory.entries.type;
+	esize  = (esize + 7) / 8;
+
+	rc = node_read_buffer(sb, node, buffer, hsize + e * isize, isize);
+	if (rc != 0) {
+		errorf("node read failed\n");
+		leavef();
+		return -1;
 	}
+	bitbuffer_init_from_buffer(&bb, buffer, isize);
+	offset = hsize + nentries * isize + bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.index);
+	bitbuffer_uninit(&bb);
+
+	s = min_t(long long, esize + SMASHFS_NAME_LEN, node->size - offset);
+	if (s < esize) {
+		errorf("invalid directory entry offset: %lld\n", offset);
+		leavef();
+		return -1;
+	}
+	rc = node_read_buffer(sb, node, buffer, offset, s);
+	if (rc != 0) {
+		errorf("node read failed\n");
+		leavef();
+		return -1;
+	}
+	bitbuffer_init_from_buffer(&bb, buffer, esize);
+	*number = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.number);
+	*length = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.length);
+	*type   = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.type);
+	bitbuffer_uninit(&bb);
+	if (*length > s - esize) {
+		errorf("invalid directory entry length: %lld\n", *length);
+		leavef();
+		return -1;
+	}
+	memcpy(name, buffer + esize, *length);
 
-	kfree(nbuffer);
 	leavef();
 	return 0;
 }
 
+/*
+ * returns 0 if the name is definitely not in the directory, using the bloom
+ * filter loaded at mount time, without touching directory data.
+ */
+static inline int directory_filter_test (struct super_block *sb, struct node *node, const char *name, unsigned int length)
+{
+	long long s;
+	long long e;
+	long long h;
+	struct bitbuffer bb;
+	struct smashfs_super_info *sbi;
+
+	sbi = sb->s_fs_info;
+	if (sbi->filters_table == NULL) {
+		return 1;
+	}
+	if (bitbuffer_init_from_buffer(&bb, sbi->filters_table, sbi->super->filters_size) != 0) {
+		return 1;
+	}
+	bitbuffer_setpos(&bb, node->number * sbi->super->bits.filter.offset);
+	s = bitbuffer_getbits(&bb, sbi->super->bits.filter.offset);
+	e = bitbuffer_getbits(&bb, sbi->super->bits.filter.offset);
+	bitbuffer_uninit(&bb);
+	h = ((sbi->super->inodes + 1) * (long long) sbi->super->bits.filter.offset + 7) / 8;
+	if (s >= e || h + e > sbi->super->filters_size) {
+		return 1;
+	}
+	return smashfs_filter_test(sbi->filters_table + h + s, e - s, name, length);
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 static inline struct dentry * smashfs_lookup (struct inode *dir, struct dentry *dentry, struct nameidata *nd)
 #else
@@ -808,99 +1099,224 @@ static inline struct dentry * smashfs_lookup (struct inode *dir, struct dentry *
 
 	struct node *node;
 
-	char *buffer;
-	char *nbuffer;
+	unsigned char buffer[16];
+	char name[SMASHFS_NAME_LEN];
 	struct bitbuffer bb;
 
 	struct inode *inode;
 	struct super_block *sb;
+	struct directory *directory;
 	struct smashfs_super_info *sbi;
 
-	long long e;
 	long long s;
+	long long l;
+	long long h;
+	long long m;
 	long long directory_parent;
 	long long directory_nentries;
 	long long directory_entry_number;
 	long long directory_entry_length;
+	long long directory_entry_type;
 
 	enterf();
 
-	inode = NULL;
-	nbuffer = NULL;
 	sb = dir->i_sb;
 	sbi = sb->s_fs_info;
 
 	node = &(smashfs_i(dir)->node);
 
-	nbuffer = kmalloc(node->size, GFP_KERNEL);
-	if (nbuffer == NULL) {
-		errorf("kmalloc failed\n");
+	if (directory_filter_test(sb, node, (const char *) dentry->d_name.name, dentry->d_name.len) == 0) {
+		debugf("filtered out: %s\n", dentry->d_name.name);
 		leavef();
-		return ERR_PTR(-ENOMEM);
+		return d_splice_alias(NULL, dentry);
 	}
 
-	buffer = nbuffer;
-	rc = node_read(sb, node, node_read_directory, &buffer, 0, node->size);
+	directory = directory_cache_get(sbi->directories, &(smashfs_i(dir)->directory));
+	if (directory != NULL) {
+		directory_entry_number = directory_lookup(directory, (const char *) dentry->d_name.name, dentry->d_name.len);
+		directory_cache_put(sbi->directories, directory);
+		if (directory_entry_number < 0) {
+			leavef();
+			return d_splice_alias(NULL, dentry);
+		}
+		inode = smashfs_get_inode(sb, directory_entry_number);
+		if (IS_ERR(inode)) {
+			errorf("get inode failed\n");
+			leavef();
+			return ERR_CAST(inode);
+		}
+		leavef();
+		return d_splice_alias(inode, dentry);
+	}
+
+	s  = 0;
+	s += sbi->super->bits.inode.directory.parent;
+	s += sbi->super->bits.inode.directory.nentries;
+	s  = (s + 7) / 8;
+	rc = node_read_buffer(sb, node, buffer, 0, s);
 	if (rc != 0) {
 		errorf("node read failed\n");
-		kfree(nbuffer);
 		leavef();
 		return ERR_PTR(-EIO);
 	}
-
-	buffer = nbuffer;
-	bitbuffer_init_from_buffer(&bb, buffer, node->size);
+	bitbuffer_init_from_buffer(&bb, buffer, s);
 	directory_parent   = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.parent);
 	directory_nentries = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.nentries);
 	bitbuffer_uninit(&bb);
 
 	debugf("number: %lld, parent: %lld, nentries: %lld\n", node->number, directory_parent, directory_nentries);
-	s  = 0;
-	s += sbi->super->bits.inode.directory.parent;
-	s += sbi->super->bits.inode.directory.nentries;
-	s  = (s + 7) / 8;
-	buffer += s;
-
-	for (e = 0; e < directory_nentries; e++) {
-		s  = 0;
-		s += sbi->super->bits.inode.directory.entries.number;
-		s += sbi->super->bits.inode.directory.entries.length;
-		s += sbi->super->bits.inode.directory.entries.type;
-		s  = (s + 7) / 8;
-
-		bitbuffer_init_from_buffer(&bb, buffer, s);
-		directory_entry_number = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.number);
-		directory_entry_length = bitbuffer_getbits(&bb, sbi->super->bits.inode.directory.entries.length);
-		/* directory_entry_type */ bitbuffer_skipbits(&bb, sbi->super->bits.inode.directory.entries.type);
-		bitbuffer_uninit(&bb);
-
-		buffer += s;
 
-		if (dentry->d_name.name[0] < buffer[0]) {
-			break;
+	l = 0;
+	h = directory_nentries - 1;
+	while (l <= h) {
+		m = l + (h - l) / 2;
+		rc = directory_entry_read(sb, node, directory_nentries, m, &directory_entry_number, &directory_entry_type, name, &directory_entry_length);
+		if (rc != 0) {
+			errorf("directory entry read failed\n");
+			leavef();
+			return ERR_PTR(-EIO);
 		}
-
-		if (directory_entry_length == dentry->d_name.len &&
-		    memcmp(buffer, dentry->d_name.name, dentry->d_name.len) == 0) {
-			debugf("  - %lld\n", directory_entry_number);
-			inode = smashfs_get_inode(sb, directory_entry_number);
-			if (inode == NULL) {
-				errorf("get inode failed\n");
-				leavef();
-				return ERR_PTR(-EIO);
-			} else {
-				kfree(nbuffer);
+		rc = memcmp(dentry->d_name.name, name, min_t(long long, dentry->d_name.len, directory_entry_length));
+		if (rc == 0) {
+			if (dentry->d_name.len == directory_entry_length) {
+				debugf("  - %lld\n", directory_entry_number);
+				inode = smashfs_get_inode(sb, directory_entry_number);
+				if (IS_ERR(inode)) {
+					errorf("get inode failed\n");
+					leavef();
+					return ERR_CAST(inode);
+				}
 				leavef();
 				return d_splice_alias(inode, dentry);
 			}
+			rc = (dentry->d_name.len < directory_entry_length) ? -1 : 1;
+		}
+		if (rc < 0) {
+			h = m - 1;
+		} else {
+			l = m + 1;
+		}
+	}
+
+	leavef();
+	return d_splice_alias(NULL, dentry);
+}
+
+static inline void smashfs_fill_page (struct page *page, void *buffer, long long size)
+{
+	void *pgdata;
+	pgdata = kmap(page);
+	memcpy(pgdata, buffer, size);
+	memset(pgdata + size, 0, PAGE_CACHE_SIZE - size);
+	flush_dcache_page(page);
+	kunmap(page);
+	SetPageUptodate(page);
+}
+
+/*
+ * fills page, and every other page of the inode that lies completely in the
+ * same data block, from one decompressed block. pages that are already cached
+ * or locked by someone else are skipped. returns 1 if page spans two blocks
+ * and has to be read with node_read.
+ */
+static inline int smashfs_readpage_block (struct inode *inode, struct page *page)
+{
+	long long p;
+	long long b;
+	long long size;
+	long long first;
+	long long last;
+	long long start;
+	long long pstart;
+	long long bstart;
+	long long bend;
+	struct node *node;
+	struct block block;
+	struct page *target;
+	struct cache_entry *entry;
+	struct smashfs_super_info *sbi;
+
+	enterf();
+
+	sbi = inode->i_sb->s_fs_info;
+	node = &(smashfs_i(inode)->node);
+
+	if (node->extents > 0) {
+		leavef();
+		return 1;
+	}
+
+	start = (node->block << sbi->super->block_log2) + node->index;
+	pstart = start + ((long long) page->index << PAGE_CACHE_SHIFT);
+	size = min_t(long long, node->size - ((long long) page->index << PAGE_CACHE_SHIFT), PAGE_CACHE_SIZE);
+	b = pstart >> sbi->super->block_log2;
+	if (((pstart + size - 1) >> sbi->super->block_log2) != b) {
+		leavef();
+		return 1;
+	}
+
+	if (sbi->super->bits.block.stored) {
+		if (block_fill(inode->i_sb, b, &block) != 0) {
+			errorf("block fill failed\n");
+			leavef();
+			return -EIO;
 		}
+		if (block.stored && block.compressed_size == 0) {
+			debugf("page: %ld, block: %lld, zero\n", page->index, b);
+			zero_user(page, 0, PAGE_CACHE_SIZE);
+			SetPageUptodate(page);
+			unlock_page(page);
+			leavef();
+			return 0;
+		}
+	}
 
-		buffer += directory_entry_length;
+	entry = cache_get(sbi->cache, b);
+	if (IS_ERR(entry)) {
+		errorf("cache get failed\n");
+		leavef();
+		return -EIO;
+	}
+	bstart = b << sbi->super->block_log2;
+	bend = bstart + cache_entry_size(entry);
+	if (pstart + size > bend) {
+		errorf("logic error\n");
+		cache_put(sbi->cache, entry);
+		leavef();
+		return -EIO;
+	}
+
+	first = (max(bstart, start) - start + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	if (start + node->size <= bend) {
+		last = (node->size - 1) >> PAGE_CACHE_SHIFT;
+	} else {
+		last = ((bend - start) >> PAGE_CACHE_SHIFT) - 1;
+	}
+	debugf("page: %ld, block: %lld, pages: %lld - %lld\n", page->index, b, first, last);
+
+	smashfs_fill_page(page, cache_entry_buffer(entry) + (pstart - bstart), size);
+	unlock_page(page);
+
+	for (p = first; p <= last; p++) {
+		if (p == page->index) {
+			continue;
+		}
+		target = grab_cache_page_nowait(inode->i_mapping, p);
+		if (target == NULL) {
+			continue;
+		}
+		if (!PageUptodate(target)) {
+			pstart = start + (p << PAGE_CACHE_SHIFT);
+			size = min_t(long long, node->size - (p << PAGE_CACHE_SHIFT), PAGE_CACHE_SIZE);
+			smashfs_fill_page(target, cache_entry_buffer(entry) + (pstart - bstart), size);
+		}
+		unlock_page(target);
+		page_cache_release(target);
 	}
 
-	kfree(nbuffer);
+	cache_put(sbi->cache, entry);
 	leavef();
-	return ERR_PTR(-ENOENT);
+	return 0;
 }
 
 static inline int smashfs_readpage (struct file *file, struct page *page)
@@ -923,10 +1339,28 @@ static inline int smashfs_readpage (struct file *file, struct page *page)
 	node = &(smashfs_i(inode)->node);
 
 	max_block = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+
+	debugf("page index: %ld, node size: %lld, max block: %d\n", page->index, node->size, max_block);
+	if (page->index < max_block) {
+		if (node->type != smashfs_inode_type_symbolic_link &&
+		    node->type != smashfs_inode_type_regular_file) {
+			errorf("unknown node type: %lld\n", node->type);
+			goto bail;
+		}
+		rc = smashfs_readpage_block(inode, page);
+		if (rc == 0) {
+			leavef();
+			return 0;
+		}
+		if (rc < 0) {
+			errorf("readpage block failed\n");
+			goto bail;
+		}
+	}
+
 	bytes_filled = 0;
 	pgdata = kmap(page);
 
-	debugf("page index: %ld, node size: %lld, max block: %d\n", page->index, node->size, max_block);
 	if (page->index < max_block) {
 		if (node->type == smashfs_inode_type_symbolic_link) {
 			buffer = pgdata;
@@ -934,7 +1368,7 @@ static inline int smashfs_readpage (struct file *file, struct page *page)
 			rc = node_read(sb, node, node_read_symbolic_link, &buffer, page->index * PAGE_CACHE_SIZE, size);
 			if (rc != 0) {
 				errorf("node read failed\n");
-				leavef();
+				kunmap(page);
 				goto bail;
 			}
 			bytes_filled = size;
@@ -944,13 +1378,10 @@ static inline int smashfs_readpage (struct file *file, struct page *page)
 			rc = node_read(sb, node, node_read_regular_file, &buffer, page->index * PAGE_CACHE_SIZE, size);
 			if (rc != 0) {
 				errorf("node read failed\n");
-				leavef();
+				kunmap(page);
 				goto bail;
 			}
 			bytes_filled = size;
-		} else {
-			errorf("unknown node type: %lld\n", node->type);
-			goto bail;
 		}
 	}
 
@@ -963,7 +1394,6 @@ static inline int smashfs_readpage (struct file *file, struct page *page)
 	leavef();
 	return 0;
 bail:
-	kunmap(page);
 	ClearPageUptodate(page);
 	SetPageError(page);
 	unlock_page(page);
@@ -971,17 +1401,48 @@ bail:
 	return 0;
 }
 
+static int smashfs_readpages_filler (void *data, struct page *page)
+{
+	return smashfs_readpage(data, page);
+}
+
+static inline int smashfs_readpages (struct file *file, struct address_space *mapping, struct list_head *pages, unsigned nr_pages)
+{
+	int rc;
+	enterf();
+	rc = read_cache_pages(mapping, pages, smashfs_readpages_filler, file);
+	leavef();
+	return rc;
+}
+
 static inline struct inode * smashfs_alloc_inode (struct super_block *sb)
 {
 	struct node_info *node;
 	node = kmem_cache_alloc(smashfs_inode_cachep, GFP_KERNEL);
-	return node ? &node->inode : NULL;
+	if (node == NULL) {
+		return NULL;
+	}
+	node->directory = NULL;
+	node->node.extent = NULL;
+	return &node->inode;
+}
+
+static inline void smashfs_release_inode (struct inode *inode)
+{
+	struct smashfs_super_info *sbi;
+	sbi = inode->i_sb->s_fs_info;
+	if (sbi != NULL && sbi->directories != NULL) {
+		directory_cache_release(sbi->directories, &(smashfs_i(inode)->directory));
+	}
+	kfree(smashfs_i(inode)->node.extent);
+	smashfs_i(inode)->node.extent = NULL;
 }
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,38)
 
 static void smashfs_destroy_inode (struct inode *inode)
 {
+	smashfs_release_inode(inode);
 	kmem_cache_free(smashfs_inode_cachep, smashfs_i(inode));
 }
 
@@ -999,6 +1460,7 @@ static inline void smashfs_i_callback (struct rcu_head *head)
 
 static inline void smashfs_destroy_inode(struct inode *inode)
 {
+	smashfs_release_inode(inode);
 	call_rcu(&inode->i_rcu, smashfs_i_callback);
 }
 
@@ -1041,6 +1503,7 @@ static inline int smashfs_remount (struct super_block *sb, int *flags, char *dat
 
 static inline void smashfs_put_super (struct super_block *sb)
 {
+	int t;
 	struct smashfs_super_info *sbi;
 
 	enterf();
@@ -1052,12 +1515,17 @@ static inline void smashfs_put_super (struct super_block *sb)
 	}
 	sbi = sb->s_fs_info;
 	sb->s_fs_info = NULL;
+	directory_cache_destroy(sbi->directories);
+	cache_destroy(sbi->cache);
 	kfree(sbi->inodes_table);
+	vfree(sbi->filters_table);
 	kfree(sbi->blocks_table);
-	compressor_destroy(sbi->compressor);
+	for (t = 0; t < SMASHFS_COMPRESSION_TYPES; t++) {
+		pool_destroy(sbi->pools[t]);
+	}
+	vfree(sbi->dictionary);
 	kfree(sbi->super);
 	kfree(sbi);
-	destroy_blockcache();
 
 	leavef();
 }
@@ -1077,7 +1545,8 @@ static const struct inode_operations smashfs_dir_inode_operations = {
 };
 
 static const struct address_space_operations smashfs_aops = {
-	.readpage = smashfs_readpage
+	.readpage  = smashfs_readpage,
+	.readpages = smashfs_readpages,
 };
 
 static const struct super_operations smashfs_super_ops = {
@@ -1088,12 +1557,86 @@ static const struct super_operations smashfs_super_ops = {
 	.remount_fs    = smashfs_remount
 };
 
+enum {
+	smashfs_option_cache_size,
+	smashfs_option_streams,
+	smashfs_option_error,
+};
+
+static const match_table_t smashfs_options = {
+	{ smashfs_option_cache_size, "cache_size=%s" },
+	{ smashfs_option_streams   , "streams=%u" },
+	{ smashfs_option_error     , NULL },
+};
+
+static inline int smashfs_parse_options (struct smashfs_super_info *sbi, char *data)
+{
+	int token;
+	int number;
+	char *p;
+	char *value;
+	substring_t args[MAX_OPT_ARGS];
+
+	enterf();
+
+	while (data != NULL && (p = strsep(&data, ",")) != NULL) {
+		if (*p == '\0') {
+			continue;
+		}
+		token = match_token(p, smashfs_options, args);
+		switch (token) {
+			case smashfs_option_cache_size:
+				value = match_strdup(&args[0]);
+				if (value == NULL) {
+					errorf("match strdup failed\n");
+					leavef();
+					return -ENOMEM;
+				}
+				sbi->cache_size = memparse(value, NULL);
+				kfree(value);
+				break;
+			case smashfs_option_streams:
+				if (match_int(&args[0], &number) != 0 || number <= 0) {
+					errorf("invalid streams option: %s\n", p);
+					leavef();
+					return -EINVAL;
+				}
+				sbi->streams = number;
+				break;
+			default:
+				errorf("unknown mount option: %s\n", p);
+				leavef();
+				return -EINVAL;
+		}
+	}
+
+	leavef();
+	return 0;
+}
+
+static inline int bcj_supported (int bcj)
+{
+	switch (bcj) {
+		case smashfs_bcj_type_x86:      return IS_ENABLED(CONFIG_XZ_DEC_X86);
+		case smashfs_bcj_type_powerpc:  return IS_ENABLED(CONFIG_XZ_DEC_POWERPC);
+		case smashfs_bcj_type_ia64:     return IS_ENABLED(CONFIG_XZ_DEC_IA64);
+		case smashfs_bcj_type_arm:      return IS_ENABLED(CONFIG_XZ_DEC_ARM);
+		case smashfs_bcj_type_armthumb: return IS_ENABLED(CONFIG_XZ_DEC_ARMTHUMB);
+		case smashfs_bcj_type_sparc:    return IS_ENABLED(CONFIG_XZ_DEC_SPARC);
+		case smashfs_bcj_type_arm64:    return IS_ENABLED(CONFIG_XZ_DEC_ARM64);
+		case smashfs_bcj_type_riscv:    return IS_ENABLED(CONFIG_XZ_DEC_RISCV);
+	}
+	return 0;
+}
+
 static inline int smashfs_fill_super (struct super_block *sb, void *data, int silent)
 {
+	int t;
 	int rc;
 	char b[BDEVNAME_SIZE];
 	void *cbuffer;
 	struct inode *root;
+	struct pool_stream *stream;
 	struct smashfs_super_info *sbi;
 	struct smashfs_super_block *sbl;
 
@@ -1109,9 +1652,21 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 	}
 
 	sb->s_fs_info = sbi;
-	sbi->compressor = NULL;
+	memset(sbi->pools, 0, sizeof(sbi->pools));
+	sbi->dictionary = NULL;
 	sbi->blocks_table = NULL;
 	sbi->inodes_table = NULL;
+	sbi->filters_table = NULL;
+	sbi->directories = NULL;
+	sbi->cache = NULL;
+	sbi->cache_size = DEFAULT_CACHE_SIZE;
+	sbi->streams = num_online_cpus();
+
+	rc = smashfs_parse_options(sbi, data);
+	if (rc != 0) {
+		errorf("parse options failed\n");
+		goto bail;
+	}
 
 	(void) b;
 	debugf("devname: %s\n", bdevname(sb->s_bdev, b));
@@ -1139,6 +1694,11 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 		goto bail;
 	}
 
+	if (sbl->version != SMASHFS_VERSION) {
+		errorf("version mismatch: 0x%08x, expected: 0x%08x\n", sbl->version, SMASHFS_VERSION);
+		goto bail;
+	}
+
 	debugf("super block:\n");
 	debugf("  magic         : 0x%08x, %u\n", sbl->magic, sbl->magic);
 	debugf("  version       : 0x%08x, %u\n", sbl->version, sbl->version);
@@ -1151,10 +1711,15 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 	debugf("  inodes_offset : 0x%08x, %u\n", sbl->inodes_offset, sbl->inodes_offset);
 	debugf("  inodes_size   : 0x%08x, %u\n", sbl->inodes_size, sbl->inodes_size);
 	debugf("  inodes_csize  : 0x%08x, %u\n", sbl->inodes_csize, sbl->inodes_csize);
+	debugf("  filters_offset: 0x%08x, %u\n", sbl->filters_offset, sbl->filters_offset);
+	debugf("  filters_size  : 0x%08x, %u\n", sbl->filters_size, sbl->filters_size);
 	debugf("  blocks_offset : 0x%08x, %u\n", sbl->blocks_offset, sbl->blocks_offset);
 	debugf("  blocks_size   : 0x%08x, %u\n", sbl->blocks_size, sbl->blocks_size);
 	debugf("  entries_offset: 0x%08x, %u\n", sbl->entries_offset, sbl->entries_offset);
 	debugf("  entries_size  : 0x%08x, %u\n", sbl->entries_size, sbl->entries_size);
+	debugf("  dictionary_offset: 0x%08x, %u\n", sbl->dictionary_offset, sbl->dictionary_offset);
+	debugf("  dictionary_size  : 0x%08x, %u\n", sbl->dictionary_size, sbl->dictionary_size);
+	debugf("  bcj_types        : 0x%08x, %u\n", sbl->bcj_types, sbl->bcj_types);
 	debugf("  bits:\n");
 	debugf("    min:\n");
 	debugf("      inode:\n");
@@ -1174,10 +1739,12 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 	debugf("      size      : %u\n", sbl->bits.inode.size);
 	debugf("      block     : %u\n", sbl->bits.inode.block);
 	debugf("      index     : %u\n", sbl->bits.inode.index);
+	debugf("      extents   : %u\n", sbl->bits.inode.extents);
 	debugf("      regular_file:\n");
 	debugf("      directory:\n");
 	debugf("        parent   : %u\n", sbl->bits.inode.directory.parent);
 	debugf("        nentries : %u\n", sbl->bits.inode.directory.nentries);
+	debugf("        index    : %u\n", sbl->bits.inode.directory.index);
 	debugf("        entries:\n");
 	debugf("          number : %u\n", sbl->bits.inode.directory.entries.number);
 	debugf("          length : %u\n", sbl->bits.inode.directory.entries.length);
@@ -1186,17 +1753,59 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 	debugf("      offset         : %u\n", sbl->bits.block.offset);
 	debugf("      compressed_size: %u\n", sbl->bits.block.compressed_size);
 	debugf("      size           : %u\n", sbl->bits.block.size);
-
-	rc = init_blockcache(sbi->super->block_size);
-	if (rc != 0) {
-		errorf("can not create block cache");
+	debugf("      stored         : %u\n", sbl->bits.block.stored);
+	debugf("      type           : %u\n", sbl->bits.block.type);
+	debugf("      bcj            : %u\n", sbl->bits.block.bcj);
+	debugf("    filter:\n");
+	debugf("      offset         : %u\n", sbl->bits.filter.offset);
+
+	/*
+	 * a pool is created for every compression type the image uses, so
+	 * blocks are decompressed with the compressor they were chosen for.
+	 */
+	if (sbl->compression_type >= SMASHFS_COMPRESSION_TYPES) {
+		errorf("invalid compression type: %u\n", sbl->compression_type);
 		goto bail;
 	}
-
-	sbi->compressor = compressor_create_type(sbl->compression_type);
-	if (sbi->compressor == NULL) {
-		errorf("compressor create failed\n");
-		goto bail;
+	sbl->compression_types |= 1 << sbl->compression_type;
+	if (sbl->dictionary_size > 0) {
+		sbi->dictionary = vmalloc(sbl->dictionary_size);
+		if (sbi->dictionary == NULL) {
+			errorf("vmalloc failed for dictionary\n");
+			goto bail;
+		}
+		rc = smashfs_read(sb, sbi->dictionary, sbl->dictionary_offset, sbl->dictionary_size);
+		if (rc != sbl->dictionary_size) {
+			errorf("read failed for dictionary\n");
+			goto bail;
+		}
+	}
+	/*
+	 * bcj filters are undone by the xz decoder itself, every filter the
+	 * image uses has to be built into it.
+	 */
+	for (t = 0; t < 32; t++) {
+		if ((sbl->bcj_types & (1U << t)) == 0) {
+			continue;
+		}
+		if (bcj_supported(t) == 0) {
+			errorf("bcj filter %d is not supported by xz decoder\n", t);
+			goto bail;
+		}
+	}
+	for (t = 0; t < SMASHFS_COMPRESSION_TYPES; t++) {
+		if ((sbl->compression_types & (1 << t)) == 0) {
+			continue;
+		}
+		if (t == smashfs_compression_type_zstd) {
+			sbi->pools[t] = pool_create(t, sbi->dictionary, sbl->dictionary_size, sbi->streams, sbl->block_size);
+		} else {
+			sbi->pools[t] = pool_create(t, NULL, 0, sbi->streams, sbl->block_size);
+		}
+		if (sbi->pools[t] == NULL) {
+			errorf("pool create failed for compression type: %d\n", t);
+			goto bail;
+		}
 	}
 
 	sbi->max_inode_size  = 0;
@@ -1211,6 +1820,7 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 	sbi->max_inode_size += sbl->bits.inode.size;
 	sbi->max_inode_size += sbl->bits.inode.block;
 	sbi->max_inode_size += sbl->bits.inode.index;
+	sbi->max_inode_size += sbl->bits.inode.extents;
 
 	sbi->inodes_table = kmalloc(sbl->inodes_size, GFP_KERNEL);
 	if (sbi->inodes_table == NULL) {
@@ -1221,6 +1831,9 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 	sbi->max_block_size  = 0;
 	sbi->max_block_size += sbl->bits.block.offset;
 	sbi->max_block_size += sbl->bits.block.compressed_size;
+	sbi->max_block_size += sbl->bits.block.stored;
+	sbi->max_block_size += sbl->bits.block.type;
+	sbi->max_block_size += sbl->bits.block.bcj;
 
 	sbi->blocks_table = kmalloc(sbl->blocks_size, GFP_KERNEL);
 
@@ -1229,9 +1842,9 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 		goto bail;
 	}
 
-	cbuffer = kmem_cache_alloc(smashfs_block_cachep, GFP_NOIO);
+	cbuffer = vmalloc(sbl->inodes_csize);
 	if (cbuffer == NULL) {
-		errorf("kmalloc failed\n");
+		errorf("vmalloc failed\n");
 		goto bail;
 	}
 	rc = smashfs_read(sb, cbuffer, sbl->inodes_offset, sbl->inodes_csize);
@@ -1239,12 +1852,14 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 		errorf("read failed for inodes table\n");
 		goto bail;
 	}
-	rc = compressor_uncompress(sbi->compressor, cbuffer, sbl->inodes_csize, sbi->inodes_table, sbl->inodes_size);
+	stream = pool_get(sbi->pools[sbl->compression_type]);
+	rc = compressor_uncompress(pool_stream_compressor(stream), cbuffer, sbl->inodes_csize, sbi->inodes_table, sbl->inodes_size);
+	pool_put(sbi->pools[sbl->compression_type], stream);
 	if (rc != sbl->inodes_size) {
 		errorf("uncompress failed\n");
 		goto bail;
 	}
-	kmem_cache_free(smashfs_block_cachep, cbuffer);
+	vfree(cbuffer);
 	cbuffer = NULL;
 
 	rc = smashfs_read(sb, sbi->blocks_table, sbl->blocks_offset, sbl->blocks_size);
@@ -1253,6 +1868,31 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 		goto bail;
 	}
 
+	if (sbl->filters_size > 0) {
+		sbi->filters_table = vmalloc(sbl->filters_size);
+		if (sbi->filters_table == NULL) {
+			errorf("vmalloc failed for filters table\n");
+			goto bail;
+		}
+		rc = smashfs_read(sb, sbi->filters_table, sbl->filters_offset, sbl->filters_size);
+		if (rc != sbl->filters_size) {
+			errorf("read failed for filters table\n");
+			goto bail;
+		}
+	}
+
+	sbi->cache = cache_create(sbi->cache_size, sbl->block_size, block_read, sb);
+	if (sbi->cache == NULL) {
+		errorf("cache create failed\n");
+		goto bail;
+	}
+
+	sbi->directories = directory_cache_create();
+	if (sbi->directories == NULL) {
+		errorf("directory cache create failed\n");
+		goto bail;
+	}
+
 	sb->s_magic = sbl->magic;
 	sb->s_maxbytes = MAX_LFS_FILESIZE;
 	sb->s_flags |= MS_RDONLY;
@@ -1281,32 +1921,42 @@ static inline int smashfs_fill_super (struct super_block *sb, void *data, int si
 		goto bail;
 	}
 
-	if (cbuffer != NULL) {
-		kmem_cache_free(smashfs_block_cachep, cbuffer);
-	}
 	leavef();
 	return 0;
 bail:
 	if (sbi != NULL) {
+		if (sbi->directories != NULL) {
+			directory_cache_destroy(sbi->directories);
+		}
+		if (sbi->cache != NULL) {
+			cache_destroy(sbi->cache);
+		}
 		if (sbi->blocks_table != NULL) {
 			kfree(sbi->blocks_table);
 		}
 		if (sbi->inodes_table != NULL) {
 			kfree(sbi->inodes_table);
 		}
-		if (sbi->compressor != NULL) {
-			compressor_destroy(sbi->compressor);
+		if (sbi->filters_table != NULL) {
+			vfree(sbi->filters_table);
+		}
+		for (t = 0; t < SMASHFS_COMPRESSION_TYPES; t++) {
+			if (sbi->pools[t] != NULL) {
+				pool_destroy(sbi->pools[t]);
+			}
+		}
+		if (sbi->dictionary != NULL) {
+			vfree(sbi->dictionary);
 		}
 		kfree(sbi);
 	}
 	if (cbuffer != NULL) {
-		kmem_cache_free(smashfs_block_cachep, cbuffer);
+		vfree(cbuffer);
 	}
 	if (sbl != NULL) {
 		kfree(sbl);
 	}
 	sb->s_fs_info = NULL;
-	destroy_blockcache();
 	leavef();
 	return -EINVAL;
 }
@@ -24,6 +24,12 @@ struct smashfs_super_info {
 	long long max_block_size;
 	struct smashfs_super_block *super;
 	unsigned char *inodes_table;
+	unsigned char *filters_table;
 	unsigned char *blocks_table;
-	struct compressor *compressor;
+	void *dictionary;
+	struct pool *pools[SMASHFS_COMPRESSION_TYPES];
+	struct cache *cache;
+	struct directory_cache *directories;
+	long long cache_size;
+	int streams;
 };
@@ -0,0 +1 @@
+gcc -Wall -Wextra -pipe -g3 -O2 -fPIC -fsigned-char -fno-strict-aliasing -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -D_LARGEFILE_SOURCE -fno-math-errno -fno-trapping-math -fassociative-math -fno-signed-zeros -D__LINUX__=1  -U_FILE_OFFSET_BITS -DSMASHFS_ENABLE_GZIP=1 -DSMASHFS_ENABLE_LZMA=1 -DSMASHFS_ENABLE_XZ=1  -I../include -M bitbuffer.c | sed 's,\(bitbuffer\.o\) *:,.mkfs.smashfs/ .mkfs.smashfs/bitbuffer.dep: ,' > .mkfs.smashfs/bitbuffer.dep
@@ -0,0 +1 @@
+gcc -Wall -Wextra -pipe -g3 -O2 -fPIC -fsigned-char -fno-strict-aliasing -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -D_LARGEFILE_SOURCE -fno-math-errno -fno-trapping-math -fassociative-math -fno-signed-zeros -D__LINUX__=1  -L/opt/local/lib -o .mkfs.smashfs/mkfs.smashfs .mkfs.smashfs/mkfs.o .mkfs.smashfs/buffer.o .mkfs.smashfs/bitbuffer.o .mkfs.smashfs/hash.o .mkfs.smashfs/arena.o .mkfs.smashfs/compressor.o .mkfs.smashfs/compressor-none.o .mkfs.smashfs/compressor-gzip.o .mkfs.smashfs/compressor-lzma.o .mkfs.smashfs/compressor-xz.o  -lpthread -lz -llzma 
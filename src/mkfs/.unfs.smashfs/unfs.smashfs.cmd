@@ -0,0 +1 @@
+gcc -Wall -Wextra -pipe -g3 -O2 -fPIC -fsigned-char -fno-strict-aliasing -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -D_LARGEFILE_SOURCE -fno-math-errno -fno-trapping-math -fassociative-math -fno-signed-zeros -D__LINUX__=1  -L/opt/local/lib -o .unfs.smashfs/unfs.smashfs .unfs.smashfs/unfs.o .unfs.smashfs/buffer.o .unfs.smashfs/bitbuffer.o .unfs.smashfs/compressor.o .unfs.smashfs/compressor-none.o .unfs.smashfs/compressor-gzip.o .unfs.smashfs/compressor-lzma.o .unfs.smashfs/compressor-xz.o  -lz -llzma 
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * append only allocator. memory is carved from large chunks and is only
+ * given back when the arena is uninitialized, so small long lived objects
+ * cost no per allocation overhead and stay close to each other.
+ */
+
+#define ARENA_ALIGN	sizeof(long long)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	unsigned long long size;
+	unsigned long long length;
+	unsigned char buffer[0] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+int arena_init (struct arena *arena, unsigned long long size)
+{
+	arena->chunks = NULL;
+	arena->size = size;
+	return 0;
+}
+
+int arena_uninit (struct arena *arena)
+{
+	struct arena_chunk *chunk;
+	while (arena->chunks != NULL) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+	return 0;
+}
+
+void * arena_alloc (struct arena *arena, unsigned long long size)
+{
+	void *pointer;
+	struct arena_chunk *chunk;
+	size = (size + ARENA_ALIGN - 1) & ~((unsigned long long) ARENA_ALIGN - 1);
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->length + size > chunk->size) {
+		chunk = malloc(sizeof(struct arena_chunk) + ((size > arena->size) ? size : arena->size));
+		if (chunk == NULL) {
+			fprintf(stderr, "malloc failed\n");
+			return NULL;
+		}
+		chunk->size = (size > arena->size) ? size : arena->size;
+		chunk->length = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	pointer = chunk->buffer + chunk->length;
+	chunk->length += size;
+	return pointer;
+}
+
+char * arena_strdup (struct arena *arena, const char *string)
+{
+	char *pointer;
+	unsigned long long length;
+	length = strlen(string) + 1;
+	pointer = arena_alloc(arena, length);
+	if (pointer == NULL) {
+		return NULL;
+	}
+	memcpy(pointer, string, length);
+	return pointer;
+}
@@ -18,53 +18,83 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <zlib.h>
 
-int gzip_compress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+#include "../include/smashfs.h"
+
+#include "compressor.h"
+
+#define GZIP_LEVEL		9
+
+#define MIN(a, b)		(((a) < (b)) ? (a) : (b))
+
+void * gzip_context_create (const struct compressor_options *options)
+{
+	int rc;
+	z_stream *stream;
+	stream = malloc(sizeof(z_stream));
+	if (stream == NULL) {
+		return NULL;
+	}
+	stream->zalloc = (alloc_func) 0;
+	stream->zfree = (free_func) 0;
+	stream->opaque = (voidpf) 0;
+	rc = deflateInit2(stream, (options->level > 0) ? MIN(options->level, 9) : GZIP_LEVEL, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY);
+	if (rc != Z_OK) {
+		fprintf(stderr, "deflateinit2 failed\n");
+		free(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+int gzip_context_destroy (void *context)
+{
+	deflateEnd(context);
+	free(context);
+	return 0;
+}
+
+int gzip_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	int rc;
 	uLong zlen;
-	z_stream stream;
+	z_stream *stream;
+	stream = context;
 	zlen = compressBound(ssize);
 	if (zlen > dsize) {
 		fprintf(stderr, "not enough space\n");
 		return -1;
 	}
-	stream.next_in = (Bytef *) src;
-	stream.avail_in = (uInt) ssize;
-	stream.next_out = dst;
-	stream.avail_out = (uInt) zlen;
-	if ((uLong) stream.avail_out != zlen) {
-		fprintf(stderr, "avail out and zlen is different\n");
+	rc = deflateReset(stream);
+	if (rc != Z_OK) {
+		fprintf(stderr, "deflatereset failed\n");
 		return -1;
 	}
-	stream.zalloc = (alloc_func) 0;
-	stream.zfree = (free_func) 0;
-	stream.opaque = (voidpf) 0;
-	rc = deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY);
-	if (rc != Z_OK) {
-		fprintf(stderr, "deflateinit2 failed\n");
+	stream->next_in = (Bytef *) src;
+	stream->avail_in = (uInt) ssize;
+	stream->next_out = dst;
+	stream->avail_out = (uInt) zlen;
+	if ((uLong) stream->avail_out != zlen) {
+		fprintf(stderr, "avail out and zlen is different\n");
 		return -1;
 	}
-	rc = deflate(&stream, Z_FINISH);
+	rc = deflate(stream, Z_FINISH);
 	if (rc != Z_STREAM_END) {
 		fprintf(stderr, "deflate failed\n");
 		return -1;
 	}
-	zlen = stream.total_out;
-	rc = deflateEnd(&stream);
-	if (rc != Z_OK) {
-		fprintf(stderr, "deflateEnd failed\n");
-		return -1;
-	}
-	return zlen;
+	return stream->total_out;
 }
 
-int gzip_uncompress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+int gzip_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	int rc;
 	z_stream strm;
+	(void) options;
 	strm.zalloc = Z_NULL;
 	strm.zfree = Z_NULL;
 	strm.opaque = Z_NULL;
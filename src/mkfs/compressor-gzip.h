@@ -17,5 +17,9 @@
  * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
-int gzip_compress (void *src, unsigned int ssize, void *dst, unsigned int dsize);
-int gzip_uncompress (void *src, unsigned int ssize, void *dst, unsigned int dsize);
+struct compressor_options;
+
+void * gzip_context_create (const struct compressor_options *options);
+int gzip_context_destroy (void *context);
+int gzip_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+int gzip_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize);
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include "../include/smashfs.h"
+
+#include "compressor.h"
+
+#define LZ4_LEVEL		LZ4HC_CLEVEL_MAX
+
+#define MIN(a, b)		(((a) < (b)) ? (a) : (b))
+
+struct lz4 {
+	int level;
+	void *state;
+};
+
+void * lz4_context_create (const struct compressor_options *options)
+{
+	struct lz4 *lz4;
+	lz4 = malloc(sizeof(struct lz4));
+	if (lz4 == NULL) {
+		return NULL;
+	}
+	lz4->level = (options->level > 0) ? MIN(options->level, LZ4HC_CLEVEL_MAX) : LZ4_LEVEL;
+	lz4->state = malloc(LZ4_sizeofStateHC());
+	if (lz4->state == NULL) {
+		free(lz4);
+		return NULL;
+	}
+	return lz4;
+}
+
+int lz4_context_destroy (void *context)
+{
+	struct lz4 *lz4;
+	lz4 = context;
+	free(lz4->state);
+	free(lz4);
+	return 0;
+}
+
+int lz4_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	int rc;
+	struct lz4 *lz4;
+	lz4 = context;
+	rc = LZ4_compress_HC_extStateHC(lz4->state, src, dst, ssize, dsize, lz4->level);
+	if (rc <= 0) {
+		fprintf(stderr, "lz4 compress failed\n");
+		return -1;
+	}
+	return rc;
+}
+
+int lz4_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	int rc;
+	(void) options;
+	rc = LZ4_decompress_safe(src, dst, ssize, dsize);
+	if (rc < 0) {
+		fprintf(stderr, "lz4 uncompress failed\n");
+		return -1;
+	}
+	return rc;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+struct compressor_options;
+
+void * lz4_context_create (const struct compressor_options *options);
+int lz4_context_destroy (void *context);
+int lz4_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+int lz4_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize);
@@ -18,45 +18,80 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <lzma.h>
 
+#include "../include/smashfs.h"
+
+#include "compressor.h"
+
 #define LZMA_OPTIONS		6
 #define MEMLIMIT		(256 * 1024 * 1024)
 
+#define MIN(a, b)		(((a) < (b)) ? (a) : (b))
 #define MAX(a, b)		(((a) > (b)) ? (a) : (b))
 
-int lzma_compress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+struct lzma {
+	lzma_stream strm;
+	uint32_t preset;
+};
+
+void * lzma_context_create (const struct compressor_options *options)
+{
+	struct lzma *lzma;
+	lzma = malloc(sizeof(struct lzma));
+	if (lzma == NULL) {
+		return NULL;
+	}
+	memset(lzma, 0, sizeof(struct lzma));
+	lzma->preset = (options->level > 0) ? MIN(options->level, 9) : LZMA_OPTIONS;
+	return lzma;
+}
+
+int lzma_context_destroy (void *context)
+{
+	struct lzma *lzma;
+	lzma = context;
+	lzma_end(&lzma->strm);
+	free(lzma);
+	return 0;
+}
+
+int lzma_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	int res;
+	struct lzma *lzma;
+	lzma_stream *strm;
 	lzma_options_lzma opt;
-	lzma_stream strm = LZMA_STREAM_INIT;
-	lzma_lzma_preset(&opt, LZMA_OPTIONS);
+	lzma = context;
+	strm = &lzma->strm;
+	lzma_lzma_preset(&opt, lzma->preset);
 	opt.dict_size = MAX(4096, ssize);
-	res = lzma_alone_encoder(&strm, &opt);
+	res = lzma_alone_encoder(strm, &opt);
 	if(res != LZMA_OK) {
 		fprintf(stderr, "lzma_alone_encoder failed\n");
-		lzma_end(&strm);
 		goto bail;
 	}
-	strm.next_out = dst;
-	strm.avail_out = dsize;
-	strm.next_in = src;
-	strm.avail_in = ssize;
-	res = lzma_code(&strm, LZMA_FINISH);
-	lzma_end(&strm);
+	strm->next_out = dst;
+	strm->avail_out = dsize;
+	strm->next_in = src;
+	strm->avail_in = ssize;
+	res = lzma_code(strm, LZMA_FINISH);
 	if(res != LZMA_STREAM_END) {
 		fprintf(stderr, "lzma_code failed\n");
 		goto bail;
 	}
-	return (int) strm.total_out;
+	return (int) strm->total_out;
 bail:	return -1;
 }
 
-int lzma_uncompress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+int lzma_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	int rc;
 	lzma_stream strm = LZMA_STREAM_INIT;
+	(void) options;
 	rc = lzma_alone_decoder(&strm, MEMLIMIT);
 	if(rc != LZMA_OK) {
 		fprintf(stderr, "lzma_alone_encoder failed\n");
@@ -19,35 +19,46 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <lzo/lzoconf.h>
 #include <lzo/lzo1x.h>
 
-int lzo_compress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+#include "../include/smashfs.h"
+
+#include "compressor.h"
+
+void * lzo_context_create (const struct compressor_options *options)
+{
+	(void) options;
+	return malloc(LZO1X_999_MEM_COMPRESS);
+}
+
+int lzo_context_destroy (void *context)
+{
+	free(context);
+	return 0;
+}
+
+int lzo_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	int rc;
 	lzo_uint outlen;
-	lzo_voidp workmem;
 	(void) dsize;
-	workmem = malloc(LZO1X_999_MEM_COMPRESS);
-	if (workmem == NULL) {
-		return -1;
-	}
-	rc = lzo1x_999_compress((lzo_bytep) src, ssize, dst, &outlen, workmem);
+	rc = lzo1x_999_compress((lzo_bytep) src, ssize, dst, &outlen, context);
 	if (rc != LZO_E_OK) {
-		free(workmem);
 		return -1;
 	}
 	if (outlen >= ssize) {
-		free(workmem);
 		return -1;
 	}
 	return outlen;
 }
 
-int lzo_uncompress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+int lzo_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	int res;
 	lzo_uint bytes = dsize;
+	(void) options;
 	res = lzo1x_decompress_safe((lzo_bytep) src, ssize, (lzo_bytep) dst, &bytes, NULL);
 	return res == LZO_E_OK ? (int) bytes : -1;
 }
@@ -17,39 +17,138 @@
  * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <lzma.h>
 
+#include "../include/smashfs.h"
+
+#include "compressor.h"
+
+#define XZ_OPTIONS		6
 #define MEMLIMIT		(256 * 1024 * 1024)
 
-int xz_compress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+#define MIN(a, b)		(((a) < (b)) ? (a) : (b))
+
+/*
+ * the encoder is set up again on the same stream for every block, liblzma
+ * then keeps the dictionary and match finder allocations of the previous
+ * block instead of allocating them again.
+ */
+struct xz {
+	lzma_stream strm;
+	uint32_t preset;
+};
+
+void * xz_context_create (const struct compressor_options *options)
 {
-	size_t lzma_len;
-	size_t lzma_pos;
+	struct xz *xz;
+	xz = malloc(sizeof(struct xz));
+	if (xz == NULL) {
+		return NULL;
+	}
+	memset(xz, 0, sizeof(struct xz));
+	xz->preset = (options->level > 0) ? MIN(options->level, 9) : XZ_OPTIONS;
+	return xz;
+}
+
+int xz_context_destroy (void *context)
+{
+	struct xz *xz;
+	xz = context;
+	lzma_end(&xz->strm);
+	free(xz);
+	return 0;
+}
+
+int xz_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	struct xz *xz;
 	lzma_ret lzma_err;
-	lzma_check lzma_ck;
-	unsigned char *lzma;
-	lzma_len = dsize;
-	lzma = dst;
-	lzma_pos = 0;
-	lzma_ck = LZMA_CHECK_CRC64;
-	if (!lzma_check_is_supported(lzma_ck)) {
-		lzma_ck = LZMA_CHECK_CRC32;
-	}
-	lzma_ck = LZMA_CHECK_NONE;
-	lzma_err = lzma_easy_buffer_encode(6, lzma_ck, NULL, src, ssize, lzma, &lzma_pos, lzma_len);
-	if (lzma_err == LZMA_OK) {
-		return lzma_pos;
-	} else {
+	lzma_stream *strm;
+	xz = context;
+	strm = &xz->strm;
+	lzma_err = lzma_easy_encoder(strm, xz->preset, LZMA_CHECK_NONE);
+	if (lzma_err != LZMA_OK) {
+		return -1;
+	}
+	strm->next_in = src;
+	strm->avail_in = ssize;
+	strm->next_out = dst;
+	strm->avail_out = dsize;
+	lzma_err = lzma_code(strm, LZMA_FINISH);
+	if (lzma_err != LZMA_STREAM_END) {
+		return -1;
+	}
+	return strm->total_out;
+}
+
+static lzma_vli xz_bcj_filter (int bcj)
+{
+	switch (bcj) {
+		case smashfs_bcj_type_x86:      return LZMA_FILTER_X86;
+		case smashfs_bcj_type_powerpc:  return LZMA_FILTER_POWERPC;
+		case smashfs_bcj_type_ia64:     return LZMA_FILTER_IA64;
+		case smashfs_bcj_type_arm:      return LZMA_FILTER_ARM;
+		case smashfs_bcj_type_armthumb: return LZMA_FILTER_ARMTHUMB;
+		case smashfs_bcj_type_sparc:    return LZMA_FILTER_SPARC;
+#if defined(LZMA_FILTER_ARM64)
+		case smashfs_bcj_type_arm64:    return LZMA_FILTER_ARM64;
+#endif
+#if defined(LZMA_FILTER_RISCV)
+		case smashfs_bcj_type_riscv:    return LZMA_FILTER_RISCV;
+#endif
+	}
+	return LZMA_VLI_UNKNOWN;
+}
+
+/*
+ * bcj filter is put in front of lzma2 in the filter chain. xz streams
+ * record their filter chain, so decoders need nothing extra to undo it.
+ */
+int xz_compress_bcj (void *context, int bcj, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	struct xz *xz;
+	lzma_ret lzma_err;
+	lzma_stream *strm;
+	lzma_options_lzma options;
+	lzma_filter filters[3];
+	xz = context;
+	strm = &xz->strm;
+	if (xz_bcj_filter(bcj) == LZMA_VLI_UNKNOWN) {
+		return -1;
+	}
+	if (lzma_lzma_preset(&options, xz->preset)) {
+		return -1;
+	}
+	filters[0].id = xz_bcj_filter(bcj);
+	filters[0].options = NULL;
+	filters[1].id = LZMA_FILTER_LZMA2;
+	filters[1].options = &options;
+	filters[2].id = LZMA_VLI_UNKNOWN;
+	filters[2].options = NULL;
+	lzma_err = lzma_stream_encoder(strm, filters, LZMA_CHECK_NONE);
+	if (lzma_err != LZMA_OK) {
+		return -1;
+	}
+	strm->next_in = src;
+	strm->avail_in = ssize;
+	strm->next_out = dst;
+	strm->avail_out = dsize;
+	lzma_err = lzma_code(strm, LZMA_FINISH);
+	if (lzma_err != LZMA_STREAM_END) {
 		return -1;
 	}
+	return strm->total_out;
 }
 
-int xz_uncompress (void *src, unsigned int ssize, void *dst, unsigned int dsize)
+int xz_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
 	size_t src_pos = 0;
 	size_t dest_pos = 0;
 	uint64_t memlimit = MEMLIMIT;
+	(void) options;
 	lzma_ret res = lzma_stream_buffer_decode(&memlimit, 0, NULL, src, &src_pos, ssize, dst, &dest_pos, dsize);
 	return res == LZMA_OK && (ssize == src_pos) ? (int) dest_pos : -1;
 }
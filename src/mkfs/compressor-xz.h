@@ -17,5 +17,10 @@
  * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
-int xz_compress (void *src, unsigned int ssize, void *dst, unsigned int dsize);
-int xz_uncompress (void *src, unsigned int ssize, void *dst, unsigned int dsize);
+struct compressor_options;
+
+void * xz_context_create (const struct compressor_options *options);
+int xz_context_destroy (void *context);
+int xz_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+int xz_compress_bcj (void *context, int bcj, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+int xz_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize);
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+#include <zdict.h>
+
+#include "../include/smashfs.h"
+
+#include "compressor.h"
+
+#define ZSTD_LEVEL		19
+
+/*
+ * a compression context keeps its parameters across blocks, only the
+ * session is reset before each block. blocks are at most 1M, so long
+ * distance matching pays off only with big block sizes.
+ */
+void * zstd_context_create (const struct compressor_options *options)
+{
+	int level;
+	size_t rc;
+	ZSTD_CCtx *cctx;
+	cctx = ZSTD_createCCtx();
+	if (cctx == NULL) {
+		return NULL;
+	}
+	level = (options->level != 0) ? options->level : ZSTD_LEVEL;
+	if (level > ZSTD_maxCLevel()) {
+		level = ZSTD_maxCLevel();
+	}
+	rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+	if (ZSTD_isError(rc)) {
+		fprintf(stderr, "zstd level set failed: %s\n", ZSTD_getErrorName(rc));
+		goto bail;
+	}
+	rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, options->long_distance ? 1 : 0);
+	if (ZSTD_isError(rc)) {
+		fprintf(stderr, "zstd long distance set failed: %s\n", ZSTD_getErrorName(rc));
+		goto bail;
+	}
+	rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 0);
+	if (ZSTD_isError(rc)) {
+		fprintf(stderr, "zstd checksum set failed: %s\n", ZSTD_getErrorName(rc));
+		goto bail;
+	}
+	if (options->dictionary != NULL) {
+		rc = ZSTD_CCtx_loadDictionary(cctx, options->dictionary, options->dictionary_size);
+		if (ZSTD_isError(rc)) {
+			fprintf(stderr, "zstd dictionary load failed: %s\n", ZSTD_getErrorName(rc));
+			goto bail;
+		}
+	}
+	return cctx;
+bail:
+	ZSTD_freeCCtx(cctx);
+	return NULL;
+}
+
+int zstd_context_destroy (void *context)
+{
+	ZSTD_freeCCtx(context);
+	return 0;
+}
+
+int zstd_compress (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	size_t rc;
+	ZSTD_CCtx *cctx;
+	cctx = context;
+	rc = ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+	if (ZSTD_isError(rc)) {
+		return -1;
+	}
+	rc = ZSTD_compress2(cctx, dst, dsize, src, ssize);
+	if (ZSTD_isError(rc)) {
+		fprintf(stderr, "zstd compress failed: %s\n", ZSTD_getErrorName(rc));
+		return -1;
+	}
+	return rc;
+}
+
+int zstd_uncompress (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	size_t rc;
+	ZSTD_DCtx *dctx;
+	if (options->dictionary != NULL) {
+		dctx = ZSTD_createDCtx();
+		if (dctx == NULL) {
+			return -1;
+		}
+		rc = ZSTD_decompress_usingDict(dctx, dst, dsize, src, ssize, options->dictionary, options->dictionary_size);
+		ZSTD_freeDCtx(dctx);
+	} else {
+		rc = ZSTD_decompress(dst, dsize, src, ssize);
+	}
+	if (ZSTD_isError(rc)) {
+		fprintf(stderr, "zstd uncompress failed: %s\n", ZSTD_getErrorName(rc));
+		return -1;
+	}
+	return rc;
+}
+
+int zstd_train (void *dictionary, unsigned int size, const void *samples, const size_t *sizes, unsigned int nsamples)
+{
+	size_t rc;
+	rc = ZDICT_trainFromBuffer(dictionary, size, samples, sizes, nsamples);
+	if (ZDICT_isError(rc)) {
+		fprintf(stderr, "zstd dictionary train failed: %s\n", ZDICT_getErrorName(rc));
+		return -1;
+	}
+	return rc;
+}
@@ -37,27 +37,61 @@
 #if defined(SMASHFS_ENABLE_XZ) && (SMASHFS_ENABLE_XZ == 1)
 #include "compressor-xz.h"
 #endif
+#if defined(SMASHFS_ENABLE_ZSTD) && (SMASHFS_ENABLE_ZSTD == 1)
+#include "compressor-zstd.h"
+#endif
+#if defined(SMASHFS_ENABLE_LZ4) && (SMASHFS_ENABLE_LZ4 == 1)
+#include "compressor-lz4.h"
+#endif
 
 struct compressor {
 	char *name;
 	enum smashfs_compression_type type;
-	int (*compress) (void *src, unsigned int ssize, void *dst, unsigned int dsize);
-	int (*uncompress) (void *src, unsigned int ssize, void *dst, unsigned int dsize);
+	void * (*context_create) (const struct compressor_options *options);
+	int (*context_destroy) (void *context);
+	int (*compress) (void *context, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+	int (*compress_bcj) (void *context, int bcj, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+	int (*uncompress) (const struct compressor_options *options, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+	int (*train) (void *dictionary, unsigned int size, const void *samples, const size_t *sizes, unsigned int nsamples);
+	int decode_cost;
+	struct compressor_options options;
+};
+
+/*
+ * decode cost is a rough estimate of the time it takes to uncompress a
+ * byte, relative to lz4. it is used to weigh compressors against each
+ * other when blocks are compressed with a set of candidates.
+ */
+
+/*
+ * compressor state lives in a context, so a job creates it once and keeps
+ * reusing it for every block it compresses. contexts are reset by the
+ * compress call itself, and must not be shared between threads.
+ */
+struct compressor_context {
+	struct compressor *compressor;
+	void *context;
 };
 
 struct compressor *compressors[] = {
-	& (struct compressor) { "none", smashfs_compression_type_none, none_compress, none_uncompress },
+	& (struct compressor) { "none", smashfs_compression_type_none, NULL                , NULL                 , none_compress, NULL           , none_uncompress, NULL      ,  0, { 0, 0, NULL, 0 } },
 #if defined(SMASHFS_ENABLE_GZIP) && (SMASHFS_ENABLE_GZIP == 1)
-	& (struct compressor) { "gzip", smashfs_compression_type_gzip, gzip_compress, gzip_uncompress },
+	& (struct compressor) { "gzip", smashfs_compression_type_gzip, gzip_context_create , gzip_context_destroy , gzip_compress, NULL           , gzip_uncompress, NULL      ,  8, { 0, 0, NULL, 0 } },
 #endif
 #if defined(SMASHFS_ENABLE_LZMA) && (SMASHFS_ENABLE_LZMA == 1)
-	& (struct compressor) { "lzma", smashfs_compression_type_lzma, lzma_compress, lzma_uncompress },
+	& (struct compressor) { "lzma", smashfs_compression_type_lzma, lzma_context_create , lzma_context_destroy , lzma_compress, NULL           , lzma_uncompress, NULL      , 24, { 0, 0, NULL, 0 } },
 #endif
 #if defined(SMASHFS_ENABLE_LZO) && (SMASHFS_ENABLE_LZO == 1)
-	& (struct compressor) { "lzo" , smashfs_compression_type_lzo , lzo_compress , lzo_uncompress  },
+	& (struct compressor) { "lzo" , smashfs_compression_type_lzo , lzo_context_create  , lzo_context_destroy  , lzo_compress , NULL           , lzo_uncompress , NULL      ,  2, { 0, 0, NULL, 0 } },
 #endif
 #if defined(SMASHFS_ENABLE_XZ) && (SMASHFS_ENABLE_XZ == 1)
-	& (struct compressor) { "xz"  , smashfs_compression_type_xz  , xz_compress  , xz_uncompress   },
+	& (struct compressor) { "xz"  , smashfs_compression_type_xz  , xz_context_create   , xz_context_destroy   , xz_compress  , xz_compress_bcj, xz_uncompress  , NULL      , 24, { 0, 0, NULL, 0 } },
+#endif
+#if defined(SMASHFS_ENABLE_ZSTD) && (SMASHFS_ENABLE_ZSTD == 1)
+	& (struct compressor) { "zstd", smashfs_compression_type_zstd, zstd_context_create , zstd_context_destroy , zstd_compress, NULL           , zstd_uncompress, zstd_train,  3, { 0, 0, NULL, 0 } },
+#endif
+#if defined(SMASHFS_ENABLE_LZ4) && (SMASHFS_ENABLE_LZ4 == 1)
+	& (struct compressor) { "lz4" , smashfs_compression_type_lz4 , lz4_context_create  , lz4_context_destroy  , lz4_compress , NULL           , lz4_uncompress , NULL      ,  1, { 0, 0, NULL, 0 } },
 #endif
 	NULL
 };
@@ -90,17 +124,109 @@ int compressor_destroy (struct compressor *compressor)
 	return 0;
 }
 
+int compressor_set_options (struct compressor *compressor, const struct compressor_options *options)
+{
+	compressor->options = *options;
+	return 0;
+}
+
+int compressor_set_dictionary (struct compressor *compressor, const void *dictionary, unsigned int size)
+{
+	compressor->options.dictionary = dictionary;
+	compressor->options.dictionary_size = size;
+	return 0;
+}
+
+int compressor_train_dictionary (struct compressor *compressor, void *dictionary, unsigned int size, const void *samples, const size_t *sizes, unsigned int nsamples)
+{
+	if (compressor->train == NULL) {
+		return -1;
+	}
+	return compressor->train(dictionary, size, samples, sizes, nsamples);
+}
+
 enum smashfs_compression_type compressor_type (struct compressor *compressor)
 {
 	return compressor->type;
 }
 
+const char * compressor_name (struct compressor *compressor)
+{
+	return compressor->name;
+}
+
+int compressor_supports_bcj (struct compressor *compressor)
+{
+	return (compressor->compress_bcj != NULL) ? 1 : 0;
+}
+
+int compressor_decode_cost (struct compressor *compressor)
+{
+	return compressor->decode_cost;
+}
+
+struct compressor_context * compressor_context_create (struct compressor *compressor)
+{
+	struct compressor_context *context;
+	context = malloc(sizeof(struct compressor_context));
+	if (context == NULL) {
+		return NULL;
+	}
+	context->compressor = compressor;
+	context->context = NULL;
+	if (compressor->context_create != NULL) {
+		context->context = compressor->context_create(&compressor->options);
+		if (context->context == NULL) {
+			free(context);
+			return NULL;
+		}
+	}
+	return context;
+}
+
+int compressor_context_destroy (struct compressor_context *context)
+{
+	if (context == NULL) {
+		return 0;
+	}
+	if (context->compressor->context_destroy != NULL) {
+		context->compressor->context_destroy(context->context);
+	}
+	free(context);
+	return 0;
+}
+
+int compressor_context_compress (struct compressor_context *context, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	return context->compressor->compress(context->context, src, ssize, dst, dsize);
+}
+
+/*
+ * compresses with the given bcj filter in front, fails if the compressor
+ * does not support it.
+ */
+int compressor_context_compress_bcj (struct compressor_context *context, int bcj, void *src, unsigned int ssize, void *dst, unsigned int dsize)
+{
+	if (context->compressor->compress_bcj == NULL) {
+		return -1;
+	}
+	return context->compressor->compress_bcj(context->context, bcj, src, ssize, dst, dsize);
+}
+
 int compressor_compress (struct compressor *compressor, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
-	return compressor->compress(src, ssize, dst, dsize);
+	int rc;
+	struct compressor_context *context;
+	context = compressor_context_create(compressor);
+	if (context == NULL) {
+		return -1;
+	}
+	rc = compressor_context_compress(context, src, ssize, dst, dsize);
+	compressor_context_destroy(context);
+	return rc;
 }
 
 int compressor_uncompress (struct compressor *compressor, void *src, unsigned int ssize, void *dst, unsigned int dsize)
 {
-	return compressor->uncompress(src, ssize, dst, dsize);
+	return compressor->uncompress(&compressor->options, src, ssize, dst, dsize);
 }
@@ -18,10 +18,33 @@
  */
 
 struct compressor;
+struct compressor_context;
+
+/*
+ * level 0 selects the default level of the compressor. long distance
+ * matching and dictionaries are only used by compressors that support
+ * them, a dictionary must outlive the compressor it is set for.
+ */
+struct compressor_options {
+	int level;
+	int long_distance;
+	const void *dictionary;
+	unsigned int dictionary_size;
+};
 
 struct compressor * compressor_create_name (const char *name);
 struct compressor * compressor_create_type (enum smashfs_compression_type type);
 int compressor_destroy (struct compressor *compressor);
+int compressor_set_options (struct compressor *compressor, const struct compressor_options *options);
+int compressor_set_dictionary (struct compressor *compressor, const void *dictionary, unsigned int size);
+int compressor_train_dictionary (struct compressor *compressor, void *dictionary, unsigned int size, const void *samples, const size_t *sizes, unsigned int nsamples);
 enum smashfs_compression_type compressor_type (struct compressor *compressor);
+const char * compressor_name (struct compressor *compressor);
+int compressor_supports_bcj (struct compressor *compressor);
+int compressor_decode_cost (struct compressor *compressor);
+struct compressor_context * compressor_context_create (struct compressor *compressor);
+int compressor_context_destroy (struct compressor_context *context);
+int compressor_context_compress (struct compressor_context *context, void *src, unsigned int ssize, void *dst, unsigned int dsize);
+int compressor_context_compress_bcj (struct compressor_context *context, int bcj, void *src, unsigned int ssize, void *dst, unsigned int dsize);
 int compressor_compress (struct compressor *compressor, void *src, unsigned int ssize, void *dst, unsigned int dsize);
 int compressor_uncompress (struct compressor *compressor, void *src, unsigned int ssize, void *dst, unsigned int dsize);
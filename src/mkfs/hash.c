@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * xxh64, four independent 64 bit lanes over 32 byte stripes, which keeps
+ * the inner loop free of dependencies and lets the compiler vectorize it.
+ */
+
+#include <string.h>
+
+#include "hash.h"
+
+#define PRIME64_1	0x9e3779b185ebca87ULL
+#define PRIME64_2	0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3	0x165667b19e3779f9ULL
+#define PRIME64_4	0x85ebca77c2b2ae63ULL
+#define PRIME64_5	0x27d4eb2f165667c5ULL
+
+static inline unsigned long long rotl64 (unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long read64 (const unsigned char *p)
+{
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline unsigned int read32 (const unsigned char *p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline unsigned long long round64 (unsigned long long acc, unsigned long long input)
+{
+	acc += input * PRIME64_2;
+	acc  = rotl64(acc, 31);
+	acc *= PRIME64_1;
+	return acc;
+}
+
+static inline unsigned long long merge64 (unsigned long long acc, unsigned long long val)
+{
+	val  = round64(0, val);
+	acc ^= val;
+	acc  = acc * PRIME64_1 + PRIME64_4;
+	return acc;
+}
+
+static inline void stripes (unsigned long long *v, const unsigned char *p, unsigned long long n)
+{
+	unsigned long long i;
+	for (i = 0; i < n; i++) {
+		v[0] = round64(v[0], read64(p + 0));
+		v[1] = round64(v[1], read64(p + 8));
+		v[2] = round64(v[2], read64(p + 16));
+		v[3] = round64(v[3], read64(p + 24));
+		p += 32;
+	}
+}
+
+int hash_init (struct hash *hash, unsigned long long seed)
+{
+	hash->seed = seed;
+	hash->v[0] = seed + PRIME64_1 + PRIME64_2;
+	hash->v[1] = seed + PRIME64_2;
+	hash->v[2] = seed + 0;
+	hash->v[3] = seed - PRIME64_1;
+	hash->total = 0;
+	hash->length = 0;
+	return 0;
+}
+
+int hash_update (struct hash *hash, const void *data, unsigned long long size)
+{
+	unsigned long long n;
+	const unsigned char *p;
+	p = data;
+	hash->total += size;
+	if (hash->length + size < 32) {
+		memcpy(hash->buffer + hash->length, p, size);
+		hash->length += size;
+		return 0;
+	}
+	if (hash->length > 0) {
+		n = 32 - hash->length;
+		memcpy(hash->buffer + hash->length, p, n);
+		stripes(hash->v, hash->buffer, 1);
+		p += n;
+		size -= n;
+		hash->length = 0;
+	}
+	n = size / 32;
+	stripes(hash->v, p, n);
+	p += n * 32;
+	size -= n * 32;
+	memcpy(hash->buffer, p, size);
+	hash->length = size;
+	return 0;
+}
+
+unsigned long long hash_final (struct hash *hash)
+{
+	unsigned long long h;
+	unsigned int i;
+	const unsigned char *p;
+	if (hash->total >= 32) {
+		h = rotl64(hash->v[0], 1) + rotl64(hash->v[1], 7) + rotl64(hash->v[2], 12) + rotl64(hash->v[3], 18);
+		h = merge64(h, hash->v[0]);
+		h = merge64(h, hash->v[1]);
+		h = merge64(h, hash->v[2]);
+		h = merge64(h, hash->v[3]);
+	} else {
+		h = hash->seed + PRIME64_5;
+	}
+	h += hash->total;
+	p = hash->buffer;
+	i = 0;
+	for (; i + 8 <= hash->length; i += 8) {
+		h ^= round64(0, read64(p + i));
+		h  = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (i + 4 <= hash->length) {
+		h ^= (unsigned long long) read32(p + i) * PRIME64_1;
+		h  = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		i += 4;
+	}
+	for (; i < hash->length; i++) {
+		h ^= p[i] * PRIME64_5;
+		h  = rotl64(h, 11) * PRIME64_1;
+	}
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+unsigned long long hash_buffer (const void *data, unsigned long long size, unsigned long long seed)
+{
+	struct hash hash;
+	hash_init(&hash, seed);
+	hash_update(&hash, data, size);
+	return hash_final(&hash);
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2013, Alper Akcan <alper.akcan@gmail.com>.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+struct hash {
+	unsigned long long v[4];
+	unsigned long long total;
+	unsigned char buffer[32];
+	unsigned int length;
+	unsigned long long seed;
+};
+
+int hash_init (struct hash *hash, unsigned long long seed);
+int hash_update (struct hash *hash, const void *data, unsigned long long size);
+unsigned long long hash_final (struct hash *hash);
+unsigned long long hash_buffer (const void *data, unsigned long long size, unsigned long long seed);
@@ -21,18 +21,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <limits.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <fts.h>
+#include <dirent.h>
+#include <elf.h>
 
 #include <sys/queue.h>
 
 #include <pthread.h>
+#include <sched.h>
 
 #include "smashfs.h"
 
@@ -40,10 +44,14 @@
 #include "buffer.h"
 #include "bitbuffer.h"
 #include "compressor.h"
+#include "hash.h"
+#include "arena.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
+#define DICTIONARY_SAMPLE_MAX	(128 * 1024)
+
 struct item {
 	char *path;
 };
@@ -53,22 +61,41 @@ struct source {
 	char *path;
 };
 
+enum elf_class {
+	elf_class_text		= 0,
+	elf_class_rodata	= 1,
+	elf_class_other		= 2,
+	elf_classes		= 3,
+};
+
+#define ELF_SECTIONS_MAX	4096
+#define ELF_EXTENTS_MAX		64
+
+struct node_extent {
+	long long offset;
+	long long size;
+	long long position;
+	int class;
+};
+
 struct node_regular_file {
 	long long size;
-	unsigned char content[0];
+	long long nextents;
+	struct node_extent *extents;
 };
 
 struct node_directory_entry {
 	long long number;
 	long long length;
 	long long type;
-	char name[0];
+	const char *name;
 };
 
 struct node_directory {
 	long long parent;
 	long long nentries;
-	struct node_directory_entry entries[0];
+	long long size;
+	struct node_directory_entry *entries;
 };
 
 struct node_symbolic_link {
@@ -103,7 +130,10 @@ struct node {
 		struct node_symbolic_link *symbolic_link;
 	};
 	long long ntype;
-	char path[128 * 1024];
+	long long bcj;
+	unsigned long long hash;
+	struct node *parent;
+	const char *name;
 	UT_hash_handle hh;
 };
 
@@ -114,6 +144,30 @@ struct block {
 	void *buffer;
 	void *cbuffer;
 	int status;
+	int stored;
+	int type;
+	int bcj;
+	int zero;
+	long long duplicate;
+};
+
+struct scan_entry {
+	char *name;
+	char *path;
+	struct stat stbuf;
+	unsigned char magic[EI_NIDENT + 4];
+	char *link;
+	unsigned int nentries;
+	struct scan_entry **entries;
+};
+
+struct scan_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int nentries;
+	unsigned int size;
+	unsigned int busy;
+	struct scan_entry **entries;
 };
 
 static LIST_HEAD(sources, source) sources;
@@ -124,14 +178,15 @@ static unsigned long long ndirectories		= 0;
 static unsigned long long nsymbolic_links	= 0;
 static unsigned long long nodes_id		= 0;
 static struct node *nodes_table			= NULL;
+static struct arena nodes_arena;
 
 static int debug				= 0;
 static char *output				= NULL;
 static unsigned int block_size			= 1024 * 1024;
 
-#define MAX_JOBS				16
-static unsigned int njobs			= 8;
-static pthread_t jobs[MAX_JOBS]			= { 0 };
+static unsigned int njobs			= 0;
+static pthread_t *jobs				= NULL;
+static int job_affinity				= 0;
 static pthread_mutex_t job_mutex                = PTHREAD_MUTEX_INITIALIZER;
 
 static int no_group_mode			= 0;
@@ -143,100 +198,1176 @@ static int no_mtime				= 0;
 static int no_padding				= 0;
 static int no_duplicates			= 0;
 
+static long long memory_limit			= 256 * 1024 * 1024;
+
 static struct compressor *compressor		= NULL;
+static struct compressor_options compressor_options = { 0, 0, NULL, 0 };
+static struct compressor *candidates[SMASHFS_COMPRESSION_TYPES];
+static unsigned int ncandidates			= 0;
+static unsigned int decode_weight		= 1;
+static long long dictionary_size		= 0;
+static void *dictionary				= NULL;
+static unsigned int dictionary_length		= 0;
+static int elf_split				= 0;
 
 static unsigned int slog (unsigned int block)
 {
-	unsigned int i;
-	for (i = 12; i <= 20; i++) {
-		if (block == (unsigned int) (1 << i)) {
-			return i;
+	unsigned int i;
+	for (i = 12; i <= 20; i++) {
+		if (block == (unsigned int) (1 << i)) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+static unsigned long long blog (long long number)
+{
+	unsigned long long i;
+	if (number < 0) {
+		return 0;
+	}
+	for (i = 1; i < 64; i++) {
+		if (number < ((long long) 1 << i)) {
+			break;
+		}
+	}
+	return i;
+}
+
+static int nodes_sort_by_number (struct node *a, struct node *b)
+{
+	if (a->number == b->number) {
+		return 0;
+	}
+	return (a->number < b->number) ? -1 : 1;
+}
+
+static const char * path_extension (const char *path)
+{
+	const char *name;
+	name = strrchr(path, '/');
+	return strrchr((name != NULL) ? name : path, '.');
+}
+
+/*
+ * nodes keep only their own name and a pointer to the directory they are
+ * in, so every directory prefix is stored once. full paths are put
+ * together on demand, only when a source file is opened.
+ */
+static int node_path (struct node *node, char *path, unsigned int size)
+{
+	unsigned int l;
+	unsigned int n;
+	struct node *p;
+	l = 0;
+	for (p = node; p != NULL; p = p->parent) {
+		l += strlen(p->name) + ((p->parent != NULL) ? 1 : 0);
+	}
+	if (l + 1 > size) {
+		fprintf(stderr, "path is too long for %s\n", node->name);
+		return -1;
+	}
+	path[l] = '\0';
+	for (p = node; p != NULL; p = p->parent) {
+		n = strlen(p->name);
+		l -= n;
+		memcpy(path + l, p->name, n);
+		if (p->parent != NULL) {
+			path[--l] = '/';
+		}
+	}
+	return 0;
+}
+
+static int nodes_sort_by_type (struct node *a, struct node *b)
+{
+#if 1
+	if (a->ntype == b->ntype) {
+		if (a->type == smashfs_inode_type_regular_file &&
+		    b->type == smashfs_inode_type_regular_file) {
+			const char *adot;
+			const char *bdot;
+			if (a->bcj != b->bcj) {
+				return (a->bcj < b->bcj) ? -1 : 1;
+			}
+			adot = path_extension(a->name);
+			bdot = path_extension(b->name);
+			if (adot != NULL &&
+			    bdot != NULL) {
+				return strcmp(adot, bdot);
+			}
+		}
+		return 0;
+	}
+	return (a->ntype < b->ntype) ? -1 : 1;
+#else
+	if (a->type == b->type) {
+		return 0;
+	}
+	return (a->type < b->type) ? -1 : 1;
+#endif
+}
+
+/*
+ * starts job j. with --affinity jobs are pinned round robin to the cpus
+ * the process is allowed to run on, so a job keeps its caches and the
+ * memory it touches first. the job runs unpinned if pinning fails.
+ */
+static int job_create (unsigned int j, void * (*function) (void *), void *arg)
+{
+	int rc;
+	int pinned;
+	pthread_attr_t attr;
+	pinned = 0;
+	pthread_attr_init(&attr);
+#if defined(__LINUX__)
+	if (job_affinity) {
+		int c;
+		int n;
+		cpu_set_t allowed;
+		cpu_set_t cpuset;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0 && CPU_COUNT(&allowed) > 0) {
+			n = j % CPU_COUNT(&allowed);
+			for (c = 0; c < CPU_SETSIZE; c++) {
+				if (CPU_ISSET(c, &allowed) && n-- == 0) {
+					break;
+				}
+			}
+			CPU_ZERO(&cpuset);
+			CPU_SET(c, &cpuset);
+			if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) == 0) {
+				pinned = 1;
+			}
+		}
+	}
+#endif
+	rc = pthread_create(&jobs[j], &attr, function, arg);
+	pthread_attr_destroy(&attr);
+	if (rc != 0 && pinned) {
+		rc = pthread_create(&jobs[j], NULL, function, arg);
+	}
+	return rc;
+}
+
+/*
+ * blocks go through a pipeline of three stages. the main thread packs
+ * entries into blocks, the jobs compress them, and a writer thread
+ * appends them to the output. stages are connected by a ring of slots
+ * sized by the memory limit. a block is compressed as soon as it is
+ * packed. it is written as soon as the blocks before it are written,
+ * which keeps the output identical however the jobs are scheduled.
+ * jobs claim blocks in order with an atomic counter. blocks are of
+ * equal size except the very last one, so this already hands out the
+ * expensive ones first.
+ */
+struct job_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int nblocks;
+	unsigned int nslots;
+	unsigned int packed;
+	unsigned int next;
+	unsigned int written;
+	int error;
+	int fd;
+	long long base;
+	long long offset;
+	struct block *blocks;
+};
+
+struct job_stat {
+	unsigned long long blocks;
+	unsigned long long stored;
+	unsigned long long bcj;
+	unsigned long long size;
+	unsigned long long compressed_size;
+	unsigned long long usecs;
+};
+
+struct job_arg {
+	struct job_queue *queue;
+	struct compressor_context *contexts[SMASHFS_COMPRESSION_TYPES];
+	void *scratch;
+	struct job_stat stat;
+};
+
+static unsigned long long job_usecs (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * output is written with positioned writes only. entries are appended at
+ * their final offsets as blocks finish, tables follow once the entries
+ * are done, and the super block is put at offset 0 last, so an image
+ * left behind by a failed run never carries a valid super block.
+ */
+static int output_pwrite (int fd, const void *buffer, long long size, long long offset)
+{
+	ssize_t rc;
+	while (size > 0) {
+		rc = pwrite(fd, buffer, size, offset);
+		if (rc <= 0) {
+			fprintf(stderr, "write failed\n");
+			return -1;
+		}
+		buffer = ((const unsigned char *) buffer) + rc;
+		size -= rc;
+		offset += rc;
+	}
+	return 0;
+}
+
+/*
+ * all zero blocks are not stored at all. comparing the block with itself
+ * shifted by one byte leaves the scan to the vectorized memcmp of libc.
+ */
+static int block_zero (const unsigned char *buffer, long long size)
+{
+	return (size > 0 && buffer[0] == 0 && memcmp(buffer, buffer + 1, size - 1) == 0) ? 1 : 0;
+}
+
+/*
+ * cheap check for data that will not compress, byte frequencies of the
+ * block are tested against a uniform distribution with a chi-square test.
+ * random and already compressed data stays far below the threshold, while
+ * anything with structure lands well above it.
+ */
+static int block_incompressible (const unsigned char *buffer, long long size)
+{
+	long long i;
+	long long d;
+	long long chi;
+	long long counts[256];
+	if (size < 4096) {
+		return 0;
+	}
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < size; i++) {
+		counts[buffer[i]] += 1;
+	}
+	chi = 0;
+	for (i = 0; i < 256; i++) {
+		d = counts[i] * 256 - size;
+		chi += d * d;
+	}
+	chi /= size * 256;
+	return (chi < 2 * 256) ? 1 : 0;
+}
+
+static void job_queue_fail (struct job_queue *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->error = 1;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * every candidate compresses the block, and the one with the lowest score
+ * wins. score is the compressed size plus the decode cost of the
+ * compressor scaled to the block size, so a slow decoder has to save
+ * enough bytes to be worth it. storing the block scores its size.
+ */
+static void * job (void *arg)
+{
+	int elf;
+	int bcj;
+	int type;
+	int filter;
+	int error;
+	int stored;
+	ssize_t rc;
+	void *dst;
+	unsigned int b;
+	unsigned int c;
+	long long cost;
+	long long score;
+	long long compressed_size;
+	unsigned long long usecs;
+	struct block *block;
+	struct job_arg *ja;
+	struct job_queue *queue;
+	ja = arg;
+	queue = ja->queue;
+	while (1) {
+		b = __sync_fetch_and_add(&queue->next, 1);
+		if (b >= queue->nblocks) {
+			break;
+		}
+		if (b >= __sync_fetch_and_add(&queue->packed, 0)) {
+			pthread_mutex_lock(&queue->mutex);
+			while (b >= queue->packed && queue->error == 0) {
+				pthread_cond_wait(&queue->cond, &queue->mutex);
+			}
+			error = queue->error;
+			pthread_mutex_unlock(&queue->mutex);
+			if (error != 0) {
+				break;
+			}
+		}
+		block = &queue->blocks[b];
+		if (block->duplicate >= 0 || block->zero) {
+			ja->stat.blocks += 1;
+			pthread_mutex_lock(&queue->mutex);
+			block->status = 2;
+			pthread_cond_broadcast(&queue->cond);
+			pthread_mutex_unlock(&queue->mutex);
+			continue;
+		}
+		usecs = job_usecs();
+		elf = block->bcj;
+		type = 0;
+		filter = 0;
+		stored = 1;
+		score = block->size;
+		compressed_size = block->size;
+		if (block_incompressible(block->buffer, block->size) == 0) {
+			/*
+			 * blocks of mostly elf data are tried with the bcj
+			 * filter of their machine first, and without it, as
+			 * the filter does not pay off for every block.
+			 */
+			for (c = 0; c < ncandidates; c++) {
+				for (bcj = elf; ; bcj = 0) {
+					dst = (stored) ? block->cbuffer : ja->scratch;
+					if (bcj != 0) {
+						rc = compressor_context_compress_bcj(ja->contexts[c], bcj, block->buffer, block->size, dst, block->size * 2);
+					} else {
+						rc = compressor_context_compress(ja->contexts[c], block->buffer, block->size, dst, block->size * 2);
+					}
+					cost = rc;
+					if (ncandidates > 1) {
+						cost += block->size * compressor_decode_cost(candidates[c]) * decode_weight / 1000;
+					}
+					if (rc >= 0 && rc < block->size && cost < score) {
+						if (dst != block->cbuffer) {
+							memcpy(block->cbuffer, dst, rc);
+						}
+						type = compressor_type(candidates[c]);
+						filter = bcj;
+						stored = 0;
+						score = cost;
+						compressed_size = rc;
+					}
+					if (bcj == 0) {
+						break;
+					}
+				}
+			}
+		}
+		if (stored) {
+			if (debug > 1) {
+				fprintf(stdout, "    storing block: %d\n", b);
+			}
+			ja->stat.stored += 1;
+		}
+		if (filter != 0) {
+			ja->stat.bcj += 1;
+		}
+		ja->stat.blocks += 1;
+		ja->stat.size += block->size;
+		ja->stat.compressed_size += compressed_size;
+		ja->stat.usecs += job_usecs() - usecs;
+		pthread_mutex_lock(&queue->mutex);
+		block->compressed_size = compressed_size;
+		block->stored = stored;
+		block->type = type;
+		block->bcj = filter;
+		block->status = 2;
+		pthread_cond_broadcast(&queue->cond);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+	return NULL;
+}
+
+static void * job_writer (void *arg)
+{
+	int rc;
+	unsigned int b;
+	struct block *block;
+	struct job_queue *queue;
+	queue = arg;
+	for (b = 0; b < queue->nblocks; b++) {
+		block = &queue->blocks[b];
+		pthread_mutex_lock(&queue->mutex);
+		while (block->status != 2 && queue->error == 0) {
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+		}
+		if (queue->error != 0) {
+			pthread_mutex_unlock(&queue->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&queue->mutex);
+		if (debug > 1) {
+			fprintf(stdout, "    compressing block: %d (3/3)\n", b);
+		}
+		if (block->zero) {
+			block->offset          = 0;
+			block->compressed_size = 0;
+			block->stored          = 1;
+			block->type            = 0;
+			block->bcj             = 0;
+		} else if (block->duplicate >= 0) {
+			block->offset          = queue->blocks[block->duplicate].offset;
+			block->compressed_size = queue->blocks[block->duplicate].compressed_size;
+			block->stored          = queue->blocks[block->duplicate].stored;
+			block->type            = queue->blocks[block->duplicate].type;
+			block->bcj             = queue->blocks[block->duplicate].bcj;
+		} else {
+			block->offset = queue->offset;
+			rc = output_pwrite(queue->fd, (block->stored) ? block->buffer : block->cbuffer, block->compressed_size, queue->base + queue->offset);
+			if (rc != 0) {
+				job_queue_fail(queue);
+				break;
+			}
+			queue->offset += block->compressed_size;
+		}
+		pthread_mutex_lock(&queue->mutex);
+		block->buffer = NULL;
+		block->cbuffer = NULL;
+		queue->written = b + 1;
+		pthread_cond_broadcast(&queue->cond);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * packed blocks are indexed by size and content hash. a block with a hit
+ * is compared with the earlier block, from its slot while the window still
+ * holds it, or read back from the output otherwise. duplicates are not
+ * compressed, their entries point at the data of the earlier block.
+ */
+struct block_dedup {
+	struct {
+		unsigned long long hash;
+		long long size;
+	} key;
+	unsigned int block;
+	UT_hash_handle hh;
+};
+
+static int block_compare_output (struct job_queue *queue, unsigned int original, const void *buffer, long long size)
+{
+	int rc;
+	ssize_t r;
+	unsigned int c;
+	void *cbuffer;
+	void *ubuffer;
+	struct block block;
+	struct compressor *decompressor;
+	rc = -1;
+	cbuffer = NULL;
+	ubuffer = NULL;
+	pthread_mutex_lock(&queue->mutex);
+	block = queue->blocks[original];
+	pthread_mutex_unlock(&queue->mutex);
+	cbuffer = malloc(block.compressed_size);
+	ubuffer = malloc(size);
+	if (cbuffer == NULL || ubuffer == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto out;
+	}
+	r = pread(queue->fd, cbuffer, block.compressed_size, queue->base + block.offset);
+	if (r != block.compressed_size) {
+		fprintf(stderr, "read failed for block: %u\n", original);
+		goto out;
+	}
+	if (block.stored) {
+		rc = memcmp(cbuffer, buffer, size);
+		goto out;
+	}
+	decompressor = NULL;
+	for (c = 0; c < ncandidates; c++) {
+		if ((int) compressor_type(candidates[c]) == block.type) {
+			decompressor = candidates[c];
+		}
+	}
+	if (decompressor == NULL) {
+		goto out;
+	}
+	r = compressor_uncompress(decompressor, cbuffer, block.compressed_size, ubuffer, size);
+	if (r != size) {
+		goto out;
+	}
+	rc = memcmp(ubuffer, buffer, size);
+out:
+	free(ubuffer);
+	free(cbuffer);
+	return rc;
+}
+
+static int directory_encode (struct node *node, struct smashfs_super_block *super, struct buffer *buffer)
+{
+	int rc;
+	long long e;
+	long long size;
+	long long index;
+	long long directory_index_size;
+	long long directory_entry_size;
+	struct bitbuffer bitbuffer;
+	struct node_directory_entry *entry;
+
+	bitbuffer_init_from_buffer(&bitbuffer, NULL, 0);
+
+	directory_index_size = (super->bits.inode.directory.index + 7) / 8;
+	directory_entry_size  = 0;
+	directory_entry_size += super->bits.inode.directory.entries.number;
+	directory_entry_size += super->bits.inode.directory.entries.length;
+	directory_entry_size += super->bits.inode.directory.entries.type;
+	directory_entry_size  = (directory_entry_size + 7) / 8;
+
+	size  = 0;
+	size += super->bits.inode.directory.parent;
+	size += super->bits.inode.directory.nentries;
+	size  = (size + 7) / 8;
+	rc = bitbuffer_init(&bitbuffer, size);
+	if (rc != 0) {
+		fprintf(stderr, "bitbuffer init failed\n");
+		goto bail;
+	}
+	bitbuffer_putbits(&bitbuffer, super->bits.inode.directory.parent  , node->directory->parent);
+	bitbuffer_putbits(&bitbuffer, super->bits.inode.directory.nentries, node->directory->nentries);
+	rc = buffer_add(buffer, bitbuffer_buffer(&bitbuffer), size);
+	if (rc < 0) {
+		fprintf(stderr, "buffer add failed\n");
+		goto bail;
+	}
+	bitbuffer_uninit(&bitbuffer);
+	index = 0;
+	for (e = 0; e < node->directory->nentries; e++) {
+		entry = &node->directory->entries[e];
+		rc = bitbuffer_init(&bitbuffer, directory_index_size);
+		if (rc != 0) {
+			fprintf(stderr, "bitbuffer init failed\n");
+			goto bail;
+		}
+		bitbuffer_putbits(&bitbuffer, super->bits.inode.directory.index, index);
+		rc = buffer_add(buffer, bitbuffer_buffer(&bitbuffer), directory_index_size);
+		if (rc < 0) {
+			fprintf(stderr, "buffer add failed\n");
+			goto bail;
+		}
+		bitbuffer_uninit(&bitbuffer);
+		index += directory_entry_size + entry->length;
+	}
+	for (e = 0; e < node->directory->nentries; e++) {
+		entry = &node->directory->entries[e];
+		rc = bitbuffer_init(&bitbuffer, directory_entry_size);
+		if (rc != 0) {
+			fprintf(stderr, "bitbuffer init failed\n");
+			goto bail;
+		}
+		bitbuffer_putbits(&bitbuffer, super->bits.inode.directory.entries.number, entry->number);
+		bitbuffer_putbits(&bitbuffer, super->bits.inode.directory.entries.length, entry->length);
+		bitbuffer_putbits(&bitbuffer, super->bits.inode.directory.entries.type, entry->type);
+		rc = buffer_add(buffer, bitbuffer_buffer(&bitbuffer), directory_entry_size);
+		if (rc < 0) {
+			fprintf(stderr, "buffer add failed\n");
+			goto bail;
+		}
+		bitbuffer_uninit(&bitbuffer);
+		rc = buffer_add(buffer, entry->name, entry->length);
+		if (rc < 0) {
+			fprintf(stderr, "buffer add failed\n");
+			goto bail;
+		}
+	}
+	return 0;
+bail:
+	bitbuffer_uninit(&bitbuffer);
+	return -1;
+}
+
+/*
+ * with --elf-split, elf files are cut on section boundaries. executable
+ * code, read-only data and everything else are packed in separate
+ * regions of the entries, each starting on a block boundary, so blocks
+ * of code are compressed with code only, and with the bcj filter.
+ * bytes between sections go with the section before them.
+ */
+static unsigned long long elf_get (const unsigned char *buffer, unsigned int size, int msb)
+{
+	unsigned int i;
+	unsigned long long value;
+	value = 0;
+	for (i = 0; i < size; i++) {
+		value |= (unsigned long long) buffer[(msb) ? (size - 1 - i) : i] << (i * 8);
+	}
+	return value;
+}
+
+#define ELF_GET(buffer, type, field, msb)	elf_get((buffer) + offsetof(type, field), sizeof(((type *) 0)->field), msb)
+
+struct elf_section {
+	long long offset;
+	long long size;
+	int class;
+};
+
+static int elf_sections_sort (const void *a, const void *b)
+{
+	const struct elf_section *sa = a;
+	const struct elf_section *sb = b;
+	if (sa->offset != sb->offset) {
+		return (sa->offset < sb->offset) ? -1 : 1;
+	}
+	return 0;
+}
+
+static int elf_extent_add (struct node_extent *extents, long long *nextents, long long offset, long long size, int class)
+{
+	if (*nextents > 0 && extents[*nextents - 1].class == class) {
+		extents[*nextents - 1].size += size;
+		return 0;
+	}
+	extents[*nextents].offset = offset;
+	extents[*nextents].size = size;
+	extents[*nextents].position = 0;
+	extents[*nextents].class = class;
+	*nextents += 1;
+	return 0;
+}
+
+static int elf_split_node (struct node *node)
+{
+	int fd;
+	int msb;
+	int is64;
+	int class;
+	ssize_t r;
+	long long e;
+	long long end;
+	long long size;
+	long long cursor;
+	long long nsections;
+	long long nextents;
+	unsigned long long type;
+	unsigned long long flags;
+	unsigned long long shoff;
+	unsigned long long shnum;
+	unsigned long long shentsize;
+	unsigned char header[sizeof(Elf64_Ehdr)];
+	unsigned char *section;
+	unsigned char *table;
+	struct elf_section *sections;
+	struct node_extent *extents;
+	char path[PATH_MAX];
+	fd = -1;
+	table = NULL;
+	sections = NULL;
+	extents = NULL;
+	size = node->regular_file->size;
+	if (node_path(node, path, sizeof(path)) != 0) {
+		goto bail;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "open failed for %s\n", path);
+		goto bail;
+	}
+	memset(header, 0, sizeof(header));
+	r = pread(fd, header, sizeof(header), 0);
+	if (r < (ssize_t) sizeof(Elf32_Ehdr)) {
+		goto out;
+	}
+	is64 = (header[EI_CLASS] == ELFCLASS64);
+	msb = (header[EI_DATA] == ELFDATA2MSB);
+	if (is64) {
+		shoff     = ELF_GET(header, Elf64_Ehdr, e_shoff, msb);
+		shnum     = ELF_GET(header, Elf64_Ehdr, e_shnum, msb);
+		shentsize = ELF_GET(header, Elf64_Ehdr, e_shentsize, msb);
+	} else {
+		shoff     = ELF_GET(header, Elf32_Ehdr, e_shoff, msb);
+		shnum     = ELF_GET(header, Elf32_Ehdr, e_shnum, msb);
+		shentsize = ELF_GET(header, Elf32_Ehdr, e_shentsize, msb);
+	}
+	/*
+	 * a malformed or truncated section header table is not an error,
+	 * the file is packed unsplit.
+	 */
+	if (shnum == 0 || shnum > ELF_SECTIONS_MAX ||
+	    shentsize != ((is64) ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)) ||
+	    shoff > (unsigned long long) size ||
+	    shnum * shentsize > (unsigned long long) size - shoff) {
+		goto out;
+	}
+	table = malloc(shnum * shentsize);
+	sections = malloc(sizeof(struct elf_section) * shnum);
+	extents = malloc(sizeof(struct node_extent) * (shnum + 1));
+	if (table == NULL || sections == NULL || extents == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	r = pread(fd, table, shnum * shentsize, shoff);
+	if (r != (ssize_t) (shnum * shentsize)) {
+		goto out;
+	}
+	nsections = 0;
+	for (e = 0; e < (long long) shnum; e++) {
+		section = table + e * shentsize;
+		if (is64) {
+			type  = ELF_GET(section, Elf64_Shdr, sh_type, msb);
+			flags = ELF_GET(section, Elf64_Shdr, sh_flags, msb);
+			sections[nsections].offset = ELF_GET(section, Elf64_Shdr, sh_offset, msb);
+			sections[nsections].size   = ELF_GET(section, Elf64_Shdr, sh_size, msb);
+		} else {
+			type  = ELF_GET(section, Elf32_Shdr, sh_type, msb);
+			flags = ELF_GET(section, Elf32_Shdr, sh_flags, msb);
+			sections[nsections].offset = ELF_GET(section, Elf32_Shdr, sh_offset, msb);
+			sections[nsections].size   = ELF_GET(section, Elf32_Shdr, sh_size, msb);
+		}
+		if (type == SHT_NULL || type == SHT_NOBITS || sections[nsections].size <= 0 ||
+		    sections[nsections].offset < 0 || sections[nsections].offset >= size) {
+			continue;
+		}
+		sections[nsections].size = MIN(sections[nsections].size, size - sections[nsections].offset);
+		if (flags & SHF_EXECINSTR) {
+			sections[nsections].class = elf_class_text;
+		} else if ((flags & SHF_ALLOC) && !(flags & SHF_WRITE)) {
+			sections[nsections].class = elf_class_rodata;
+		} else {
+			sections[nsections].class = elf_class_other;
+		}
+		nsections += 1;
+	}
+	qsort(sections, nsections, sizeof(struct elf_section), elf_sections_sort);
+	cursor = 0;
+	nextents = 0;
+	for (e = 0; e < nsections; e++) {
+		end = sections[e].offset + sections[e].size;
+		if (end <= cursor) {
+			continue;
+		}
+		if (sections[e].offset > cursor) {
+			class = (nextents > 0) ? extents[nextents - 1].class : elf_class_other;
+			elf_extent_add(extents, &nextents, cursor, sections[e].offset - cursor, class);
+			cursor = sections[e].offset;
+		}
+		elf_extent_add(extents, &nextents, cursor, end - cursor, sections[e].class);
+		cursor = end;
+	}
+	if (cursor < size) {
+		elf_extent_add(extents, &nextents, cursor, size - cursor, elf_class_other);
+	}
+	if (nextents < 2 || nextents > ELF_EXTENTS_MAX) {
+		goto out;
+	}
+	node->regular_file->extents = arena_alloc(&nodes_arena, sizeof(struct node_extent) * nextents);
+	if (node->regular_file->extents == NULL) {
+		fprintf(stderr, "arena alloc failed\n");
+		goto bail;
+	}
+	memcpy(node->regular_file->extents, extents, sizeof(struct node_extent) * nextents);
+	node->regular_file->nextents = nextents;
+out:
+	free(extents);
+	free(sections);
+	free(table);
+	close(fd);
+	return 0;
+bail:
+	free(extents);
+	free(sections);
+	free(table);
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+/*
+ * entry of a split file is its extent map, see smashfs.h.
+ */
+static int extents_encode (struct node *node, struct buffer *buffer)
+{
+	int rc;
+	long long e;
+	long long size;
+	struct bitbuffer bitbuffer;
+	size = node->regular_file->nextents * SMASHFS_EXTENT_SIZE;
+	rc = bitbuffer_init(&bitbuffer, size);
+	if (rc != 0) {
+		fprintf(stderr, "bitbuffer init failed\n");
+		return -1;
+	}
+	for (e = 0; e < node->regular_file->nextents; e++) {
+		bitbuffer_putbits(&bitbuffer, 32, node->regular_file->extents[e].position);
+		bitbuffer_putbits(&bitbuffer, 32, node->regular_file->extents[e].size);
+	}
+	rc = buffer_add(buffer, bitbuffer_buffer(&bitbuffer), size);
+	bitbuffer_uninit(&bitbuffer);
+	if (rc < 0) {
+		fprintf(stderr, "buffer add failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * size of a node in the entries, which is the extent map for a split file.
+ */
+static long long node_entry_size (struct node *node)
+{
+	if (node->type == smashfs_inode_type_regular_file && node->regular_file->nextents > 0) {
+		return node->regular_file->nextents * SMASHFS_EXTENT_SIZE;
+	}
+	return node->size;
+}
+
+/*
+ * produces the entries stream, the concatenated data of nodes in table
+ * order, without holding more than one directory or symbolic link in
+ * memory. regular file contents are read from the source as they are
+ * needed. extents of split files follow, one phase per elf class, padded
+ * with zeros up to the positions they were laid out at.
+ */
+struct entry_stream {
+	int phase;
+	struct node *node;
+	long long extent;
+	long long offset;
+	long long position;
+	long long data;
+	long long hole;
+	int fd;
+	struct buffer buffer;
+	struct smashfs_super_block *super;
+	long long bcj[SMASHFS_BCJ_TYPES];
+	char path[PATH_MAX];
+};
+
+static int entry_stream_init (struct entry_stream *stream, struct smashfs_super_block *super)
+{
+	stream->phase = 0;
+	stream->node = nodes_table;
+	stream->extent = 0;
+	stream->offset = 0;
+	stream->position = 0;
+	stream->data = 0;
+	stream->hole = 0;
+	stream->fd = -1;
+	stream->super = super;
+	memset(stream->bcj, 0, sizeof(stream->bcj));
+	buffer_init(&stream->buffer);
+	return 0;
+}
+
+static int entry_stream_uninit (struct entry_stream *stream)
+{
+	if (stream->fd >= 0) {
+		close(stream->fd);
+	}
+	buffer_uninit(&stream->buffer);
+	return 0;
+}
+
+/*
+ * moves to the next extent of the class of the current phase, or to the
+ * next phase when there is none left.
+ */
+static void entry_stream_next_extent (struct entry_stream *stream)
+{
+	struct node *node;
+	while (stream->phase <= elf_classes) {
+		for (node = stream->node; node != NULL; node = node->hh.next, stream->extent = 0) {
+			if (node->type != smashfs_inode_type_regular_file) {
+				continue;
+			}
+			for (; stream->extent < node->regular_file->nextents; stream->extent++) {
+				if (node->regular_file->extents[stream->extent].class == stream->phase - 1) {
+					stream->node = node;
+					return;
+				}
+			}
+		}
+		stream->phase += 1;
+		stream->node = nodes_table;
+		stream->extent = 0;
+	}
+	stream->node = NULL;
+}
+
+/*
+ * reads from the extent the stream is at, or the padding in front of it.
+ */
+static long long entry_stream_read_extent (struct entry_stream *stream, unsigned char *buffer, long long size)
+{
+	int rc;
+	ssize_t r;
+	struct node *node;
+	struct node_extent *extent;
+	node = stream->node;
+	extent = &node->regular_file->extents[stream->extent];
+	if (stream->position < extent->position) {
+		r = MIN(size, extent->position - stream->position);
+		memset(buffer, 0, r);
+		stream->bcj[0] += r;
+		stream->position += r;
+		return r;
+	}
+	if (stream->fd < 0) {
+		rc = node_path(node, stream->path, sizeof(stream->path));
+		if (rc != 0) {
+			return -1;
+		}
+		stream->fd = open(stream->path, O_RDONLY);
+		if (stream->fd < 0) {
+			fprintf(stderr, "open failed for %s\n", stream->path);
+			return -1;
+		}
+	}
+	r = MIN(size, extent->size - stream->offset);
+	r = pread(stream->fd, buffer, r, extent->offset + stream->offset);
+	if (r <= 0) {
+		fprintf(stderr, "read failed for %s, size changed?\n", stream->path);
+		return -1;
+	}
+	stream->bcj[(extent->class == elf_class_text) ? node->bcj : 0] += r;
+	stream->offset += r;
+	stream->position += r;
+	if (stream->offset == extent->size) {
+		close(stream->fd);
+		stream->fd = -1;
+		stream->offset = 0;
+		stream->extent += 1;
+		entry_stream_next_extent(stream);
+	}
+	return r;
+}
+
+/*
+ * reads a regular file at offset. holes of sparse files are found with
+ * SEEK_DATA and SEEK_HOLE and filled with zeros without reading them.
+ * data is the start of the next data region, hole the end of it.
+ */
+static ssize_t entry_stream_pread (struct entry_stream *stream, unsigned char *buffer, long long size, long long offset, long long length)
+{
+	long long r;
+	if (offset >= stream->hole) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+		stream->data = lseek(stream->fd, offset, SEEK_DATA);
+		if (stream->data < 0) {
+			stream->data = (errno == ENXIO) ? length : offset;
+		}
+		stream->hole = (stream->data < length) ? lseek(stream->fd, stream->data, SEEK_HOLE) : length;
+		if (stream->hole < 0 || stream->hole > length) {
+			stream->hole = length;
 		}
+#else
+		stream->data = offset;
+		stream->hole = length;
+#endif
 	}
-	return 0;
+	if (offset < stream->data) {
+		r = MIN(size, stream->data - offset);
+		memset(buffer, 0, r);
+		return r;
+	}
+	return pread(stream->fd, buffer, MIN(size, stream->hole - offset), offset);
 }
 
-static unsigned long long blog (long long number)
+/*
+ * reads from the node the stream is at.
+ */
+static long long entry_stream_read_node (struct entry_stream *stream, unsigned char *buffer, long long size)
 {
-	unsigned long long i;
-	if (number < 0) {
-		return 0;
+	int rc;
+	ssize_t r;
+	struct node *node;
+	node = stream->node;
+	if (stream->offset == 0 && stream->fd < 0 && buffer_length(&stream->buffer) == 0) {
+		if (node->type == smashfs_inode_type_regular_file && node->regular_file->nextents > 0) {
+			rc = extents_encode(node, &stream->buffer);
+			if (rc != 0) {
+				fprintf(stderr, "extents encode failed\n");
+				return -1;
+			}
+		} else if (node->type == smashfs_inode_type_regular_file) {
+			rc = node_path(node, stream->path, sizeof(stream->path));
+			if (rc != 0) {
+				return -1;
+			}
+			stream->fd = open(stream->path, O_RDONLY);
+			if (stream->fd < 0) {
+				fprintf(stderr, "open failed for %s\n", stream->path);
+				return -1;
+			}
+			stream->data = 0;
+			stream->hole = 0;
+		} else if (node->type == smashfs_inode_type_directory) {
+			rc = directory_encode(node, stream->super, &stream->buffer);
+			if (rc != 0) {
+				fprintf(stderr, "directory encode failed\n");
+				return -1;
+			}
+		} else if (node->type == smashfs_inode_type_symbolic_link) {
+			rc = buffer_add(&stream->buffer, node->symbolic_link->path, strlen(node->symbolic_link->path) + 1);
+			if (rc < 0) {
+				fprintf(stderr, "buffer add failed\n");
+				return -1;
+			}
+		}
 	}
-	for (i = 1; i < 64; i++) {
-		if (number < ((long long) 1 << i)) {
-			break;
+	r = MIN(size, node_entry_size(node) - stream->offset);
+	if (r > 0) {
+		if (stream->fd >= 0) {
+			r = entry_stream_pread(stream, buffer, r, stream->offset, node->size);
+			if (r <= 0) {
+				fprintf(stderr, "read failed for %s, size changed?\n", stream->path);
+				return -1;
+			}
+			stream->bcj[node->bcj] += r;
+		} else {
+			memcpy(buffer, ((unsigned char *) buffer_buffer(&stream->buffer)) + stream->offset, r);
+			stream->bcj[0] += r;
 		}
+		stream->offset += r;
+		stream->position += r;
 	}
-	return i;
+	if (stream->offset == node_entry_size(node)) {
+		if (stream->fd >= 0) {
+			close(stream->fd);
+			stream->fd = -1;
+		}
+		buffer_reset(&stream->buffer);
+		stream->offset = 0;
+		stream->node = node->hh.next;
+		if (stream->node == NULL) {
+			stream->phase = 1;
+			stream->node = nodes_table;
+			stream->extent = 0;
+			entry_stream_next_extent(stream);
+		}
+	}
+	return MAX(r, 0);
 }
 
-static int nodes_sort_by_number (struct node *a, struct node *b)
+static long long entry_stream_read (struct entry_stream *stream, unsigned char *buffer, long long size)
 {
-	if (a->number == b->number) {
-		return 0;
+	long long r;
+	long long total;
+	total = 0;
+	while (total < size && stream->node != NULL) {
+		if (stream->phase == 0) {
+			r = entry_stream_read_node(stream, buffer + total, size - total);
+		} else {
+			r = entry_stream_read_extent(stream, buffer + total, size - total);
+		}
+		if (r < 0) {
+			return -1;
+		}
+		total += r;
 	}
-	return (a->number < b->number) ? -1 : 1;
+	return total;
 }
 
-static int nodes_sort_by_type (struct node *a, struct node *b)
+/*
+ * trains a zstd dictionary from entries, in the order they are packed.
+ * entries up to DICTIONARY_SAMPLE_MAX bytes are sampled evenly across
+ * the stream, and samples add up to at most a hundred times the
+ * dictionary size. small files have little to match against within a
+ * block, a dictionary shared by every block gives them that history.
+ */
+static int dictionary_train (struct smashfs_super_block *super)
 {
-#if 1
-	if (a->ntype == b->ntype) {
-		if (a->type == smashfs_inode_type_regular_file &&
-		    b->type == smashfs_inode_type_regular_file) {
-			char *adot = strrchr(a->path, '.');
-			char *bdot = strrchr(b->path, '.');
-			if (adot != NULL &&
-			    bdot != NULL) {
-				return strcmp(adot, bdot);
-			}
+	int rc;
+	long long r;
+	long long seen;
+	long long total;
+	long long taken;
+	long long budget;
+	unsigned int c;
+	unsigned int nsamples;
+	size_t *sizes;
+	unsigned char *samples;
+	struct node *node;
+	struct node *nnode;
+	struct compressor *trainer;
+	struct entry_stream stream;
+	sizes = NULL;
+	samples = NULL;
+	trainer = NULL;
+	for (c = 0; c < ncandidates; c++) {
+		if (compressor_type(candidates[c]) == smashfs_compression_type_zstd) {
+			trainer = candidates[c];
 		}
-		return 0;
 	}
-	return (a->ntype < b->ntype) ? -1 : 1;
-#else
-	if (a->type == b->type) {
+	if (trainer == NULL) {
+		fprintf(stderr, "dictionary needs zstd compressor\n");
+		return -1;
+	}
+	entry_stream_init(&stream, super);
+	total = 0;
+	nsamples = 0;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		if (node->size > 0 && node->size <= DICTIONARY_SAMPLE_MAX) {
+			total += node->size;
+			nsamples += 1;
+		}
+	}
+	if (nsamples == 0) {
+		fprintf(stderr, "no entries to train dictionary, continuing without dictionary\n");
+		entry_stream_uninit(&stream);
 		return 0;
 	}
-	return (a->type < b->type) ? -1 : 1;
-#endif
-}
-
-struct job_arg {
-	unsigned int nblocks;
-	struct block *blocks;
-};
-
-static void * job (void *arg)
-{
-	ssize_t rc;
-	unsigned int b;
-	struct job_arg *ja;
-	ja = arg;
-	for (b = 0; b < ja->nblocks; b++) {
-		pthread_mutex_lock(&job_mutex);
-		if (ja->blocks[b].status != 0) {
-			pthread_mutex_unlock(&job_mutex);
+	budget = MIN(dictionary_size * 100, memory_limit);
+	samples = malloc(MIN(total, budget));
+	sizes = malloc(sizeof(size_t) * nsamples);
+	if (samples == NULL || sizes == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	seen = 0;
+	taken = 0;
+	nsamples = 0;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		if (node->size <= 0 || node->size > DICTIONARY_SAMPLE_MAX || node_entry_size(node) != node->size) {
 			continue;
 		}
-		ja->blocks[b].status = 1;
-		pthread_mutex_unlock(&job_mutex);
-		rc = compressor_compress(compressor, ja->blocks[b].buffer, ja->blocks[b].size, ja->blocks[b].cbuffer, ja->blocks[b].size * 2);
-		if (rc < 0) {
-			fprintf(stderr, "compress failed\n");
-			goto bail;
+		seen += node->size;
+		if ((taken + node->size) * total > seen * budget) {
+			continue;
 		}
-		if (rc > ja->blocks[b].size) {
-			fprintf(stderr, "compressed size is bigger than actual size (%zd > %lld)\n", rc, ja->blocks[b].size);
+		stream.node = node;
+		stream.offset = 0;
+		r = entry_stream_read(&stream, samples + taken, node->size);
+		if (r != node->size) {
+			fprintf(stderr, "entry stream read failed\n");
 			goto bail;
 		}
-		ja->blocks[b].compressed_size = rc;
-		pthread_mutex_lock(&job_mutex);
-		ja->blocks[b].status = 2;
-		pthread_mutex_unlock(&job_mutex);
+		sizes[nsamples++] = node->size;
+		taken += node->size;
+	}
+	dictionary = malloc(dictionary_size);
+	if (dictionary == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	fprintf(stdout, "  training dictionary from %u samples, %lld bytes\n", nsamples, taken);
+	rc = compressor_train_dictionary(trainer, dictionary, dictionary_size, samples, sizes, nsamples);
+	if (rc <= 0) {
+		fprintf(stderr, "dictionary train failed, continuing without dictionary\n");
+		free(dictionary);
+		dictionary = NULL;
+	} else {
+		dictionary_length = rc;
+		compressor_set_dictionary(trainer, dictionary, dictionary_length);
 	}
+	entry_stream_uninit(&stream);
+	free(samples);
+	free(sizes);
+	return 0;
 bail:
-	return NULL;
+	entry_stream_uninit(&stream);
+	free(samples);
+	free(sizes);
+	return -1;
 }
 
 static int output_write (void)
@@ -247,9 +1378,13 @@ static int output_write (void)
 	ssize_t size;
 
 	long long e;
-	long long s;
 
 	unsigned int b;
+	unsigned int c;
+	unsigned int n;
+	unsigned int w;
+	unsigned int nwindow;
+	unsigned int t;
 	unsigned char *bb;
 	unsigned char *bc;
 	struct block *blocks;
@@ -263,6 +1398,7 @@ static int output_write (void)
 	long long index;
 	long long block;
 	long long total;
+	long long length;
 
 	long long min_inode_ctime;
 	long long min_inode_mtime;
@@ -285,32 +1421,59 @@ static int output_write (void)
 	long long max_inode_directory_entries_number;
 	long long max_inode_directory_entries_length;
 	long long max_inode_directory_entries_type;
+	long long max_inode_directory_index;
+	long long directory_entry_size;
 
 	long long max_block_offset;
 	long long max_block_size;
 	long long max_block_compressed_size;
 	long long min_block_compressed_size;
+	long long max_block_type;
+	long long max_block_bcj;
+	long long max_node_bcj;
+	long long max_inode_extents;
+	long long nblock_duplicates;
+	long long nblock_zeros;
+	struct block_dedup *dedups;
+	struct block_dedup *dedup;
+	struct block_dedup *original;
+	struct block_dedup *dedup_table;
+	long long nsplit;
+	long long nextents;
+	int aligned;
+
+	long long max_filter_offset;
+	unsigned char *filter;
 
 	struct buffer inode_buffer;
+	struct buffer filter_buffer;
 	struct buffer block_buffer;
 	struct buffer entry_buffer;
 	struct buffer super_buffer;
 	struct buffer inode_cbuffer;
-	struct buffer entry_cbuffer;
 	struct bitbuffer bitbuffer;
+	struct entry_stream stream;
 
-	struct job_arg job_arg;
+	pthread_t writer;
+	struct job_queue job_queue;
+	struct job_arg *job_args;
 
 	fd = -1;
+	bb = NULL;
 	bc = NULL;
+	filter = NULL;
 	blocks = NULL;
+	dedups = NULL;
+	dedup_table = NULL;
+	job_args = NULL;
 	buffer_init(&inode_buffer);
+	buffer_init(&filter_buffer);
 	buffer_init(&block_buffer);
 	buffer_init(&entry_buffer);
 	buffer_init(&super_buffer);
 	buffer_init(&inode_cbuffer);
-	buffer_init(&entry_cbuffer);
 	bitbuffer_init_from_buffer(&bitbuffer, NULL, 0);
+	entry_stream_init(&stream, &super);
 
 	fprintf(stdout, "writing file: %s\n", output);
 
@@ -351,12 +1514,10 @@ static int output_write (void)
 		} else if (node->type == smashfs_inode_type_directory) {
 			max_inode_directory_parent   = MAX(max_inode_directory_parent  , node->directory->parent);
 			max_inode_directory_nentries = MAX(max_inode_directory_nentries, node->directory->nentries);
-			size = sizeof(struct node_directory);
 			for (e = 0; e < node->directory->nentries; e++) {
-				max_inode_directory_entries_number = MAX(max_inode_directory_entries_number, ((struct node_directory_entry *) (((unsigned char *) node->directory) + size))->number);
-				max_inode_directory_entries_length = MAX(max_inode_directory_entries_length, ((struct node_directory_entry *) (((unsigned char *) node->directory) + size))->length);
-				max_inode_directory_entries_type   = MAX(max_inode_directory_entries_type  , ((struct node_directory_entry *) (((unsigned char *) node->directory) + size))->type);
-				size += sizeof(struct node_directory_entry) + ((struct node_directory_entry *) (((unsigned char *) node->directory) + size))->length;
+				max_inode_directory_entries_number = MAX(max_inode_directory_entries_number, node->directory->entries[e].number);
+				max_inode_directory_entries_length = MAX(max_inode_directory_entries_length, node->directory->entries[e].length);
+				max_inode_directory_entries_type   = MAX(max_inode_directory_entries_type  , node->directory->entries[e].type);
 			}
 		} else if (node->type == smashfs_inode_type_symbolic_link) {
 		} else {
@@ -374,7 +1535,7 @@ static int output_write (void)
 	fprintf(stdout, "  setting super block (1/4)\n");
 
 	super.magic            = SMASHFS_MAGIC;
-	super.version          = SMASHFS_VERSION_0;
+	super.version          = SMASHFS_VERSION;
 	super.ctime            = 0;
 	super.block_size       = block_size;
 	super.block_log2       = slog(block_size);
@@ -400,123 +1561,327 @@ static int output_write (void)
 	super.bits.inode.directory.entries.length = blog(max_inode_directory_entries_length);
 	super.bits.inode.directory.entries.type   = blog(max_inode_directory_entries_type);
 
+	/*
+	 * directory entries are sorted by name, and each directory carries a
+	 * fixed width index of entry offsets, relative to its first entry, so
+	 * lookups can binary search without parsing every entry.
+	 */
+	directory_entry_size  = 0;
+	directory_entry_size += super.bits.inode.directory.entries.number;
+	directory_entry_size += super.bits.inode.directory.entries.length;
+	directory_entry_size += super.bits.inode.directory.entries.type;
+	directory_entry_size  = (directory_entry_size + 7) / 8;
+	max_inode_directory_index = -1;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		if (node->type != smashfs_inode_type_directory) {
+			continue;
+		}
+		index = 0;
+		for (e = 0; e < node->directory->nentries; e++) {
+			max_inode_directory_index = MAX(max_inode_directory_index, index);
+			index += directory_entry_size + node->directory->entries[e].length;
+		}
+	}
+	super.bits.inode.directory.index = blog(max_inode_directory_index);
+
 	fprintf(stdout, "  sorting inodes table by type\n");
 
 	HASH_SRT(hh, nodes_table, nodes_sort_by_type);
 	if (debug > 2) {
 		HASH_ITER(hh, nodes_table, node, nnode) {
-			fprintf(stdout, "    type: %lld, ntype: %lld, path: %s\n", node->type, node->ntype, node->path);
+			fprintf(stdout, "    type: %lld, ntype: %lld, name: %s\n", node->type, node->ntype, node->name);
 		}
 	}
 
-	fprintf(stdout, "  filling entry blocks\n");
+	fprintf(stdout, "  laying out entries\n");
 
 	offset = 0;
-	buffer_init(&entry_buffer);
+	nsplit = 0;
+	nextents = 0;
 	HASH_ITER(hh, nodes_table, node, nnode) {
 		if (node->type == smashfs_inode_type_regular_file) {
-			rc = buffer_add(&entry_buffer, node->regular_file->content, node->regular_file->size);
-			if (rc < 0) {
-				fprintf(stdout, "buffer add failed\n");
-				goto bail;
-			}
-			node->size = rc;
-			index = offset & ((1 << super.block_log2) - 1);
-			block = offset >> super.block_log2;
-			node->block = block;
-			node->index = index;
-			offset += node->size;
-		} else if (node->type == smashfs_inode_type_directory) {
-			size  = 0;
-			size += super.bits.inode.directory.parent;
-			size += super.bits.inode.directory.nentries;
-			size  = (size + 7) / 8;
-			rc = bitbuffer_init(&bitbuffer, size);
-			if (rc != 0) {
-				fprintf(stderr, "bitbuffer init failed\n");
-				goto bail;
-			}
-			bitbuffer_putbits(&bitbuffer, super.bits.inode.directory.parent  , node->directory->parent);
-			bitbuffer_putbits(&bitbuffer, super.bits.inode.directory.nentries, node->directory->nentries);
-			rc = buffer_add(&entry_buffer, bitbuffer_buffer(&bitbuffer), size);
-			if (rc < 0) {
-				fprintf(stdout, "buffer add failed\n");
-				goto bail;
-			}
-			node->size = rc;
-			bitbuffer_uninit(&bitbuffer);
-			s = sizeof(struct node_directory);
-			for (e = 0; e < node->directory->nentries; e++) {
-				size  = 0;
-				size += super.bits.inode.directory.entries.number;
-				size += super.bits.inode.directory.entries.length;
-				size += super.bits.inode.directory.entries.type;
-				size  = (size + 7) / 8;
-				rc = bitbuffer_init(&bitbuffer, size);
+			node->size = node->regular_file->size;
+			if (elf_split && node->ntype == node_type_elf_file) {
+				rc = elf_split_node(node);
 				if (rc != 0) {
-					fprintf(stderr, "bitbuffer init failed\n");
-					goto bail;
-				}
-				bitbuffer_putbits(&bitbuffer, super.bits.inode.directory.entries.number, ((struct node_directory_entry *) (((unsigned char *) node->directory) + s))->number);
-				bitbuffer_putbits(&bitbuffer, super.bits.inode.directory.entries.length, ((struct node_directory_entry *) (((unsigned char *) node->directory) + s))->length);
-				bitbuffer_putbits(&bitbuffer, super.bits.inode.directory.entries.type, ((struct node_directory_entry *) (((unsigned char *) node->directory) + s))->type);
-				rc = buffer_add(&entry_buffer, bitbuffer_buffer(&bitbuffer), size);
-				if (rc < 0) {
-					fprintf(stdout, "buffer add failed\n");
+					fprintf(stderr, "elf split failed\n");
 					goto bail;
 				}
-				node->size += rc;
-				rc = buffer_add(&entry_buffer, ((struct node_directory_entry *) (((unsigned char *) node->directory) + s))->name, ((struct node_directory_entry *) (((unsigned char *) node->directory) + s))->length);
-				if (rc < 0) {
-					fprintf(stdout, "buffer add failed\n");
-					goto bail;
+				if (node->regular_file->nextents > 0) {
+					nsplit += 1;
+					nextents += node->regular_file->nextents;
 				}
-				node->size += rc;
-				bitbuffer_uninit(&bitbuffer);
-				s += sizeof(struct node_directory_entry) + ((struct node_directory_entry *) (((unsigned char *) node->directory) + s))->length;
 			}
-			index = offset & ((1 << super.block_log2) - 1);
-			block = offset >> super.block_log2;
-			node->block = block;
-			node->index = index;
-			offset += node->size;
-		} else if (node->type == smashfs_inode_type_symbolic_link) {
-			rc = buffer_add(&entry_buffer, node->symbolic_link->path, strlen(node->symbolic_link->path) + 1);
-			if (rc < 0) {
-				fprintf(stdout, "buffer add failed\n");
+		} else if (node->type == smashfs_inode_type_directory) {
+			buffer_reset(&entry_buffer);
+			rc = directory_encode(node, &super, &entry_buffer);
+			if (rc != 0) {
+				fprintf(stderr, "directory encode failed\n");
 				goto bail;
 			}
-			node->size = rc;
-			index = offset & ((1 << super.block_log2) - 1);
-			block = offset >> super.block_log2;
-			node->block = block;
-			node->index = index;
-			offset += node->size;
+			node->size = buffer_length(&entry_buffer);
+		} else if (node->type == smashfs_inode_type_symbolic_link) {
+			node->size = strlen(node->symbolic_link->path) + 1;
 		} else {
 			fprintf(stderr, "unknown type: %lld\n", node->type);
+			continue;
+		}
+		index = offset & ((1 << super.block_log2) - 1);
+		block = offset >> super.block_log2;
+		node->block = block;
+		node->index = index;
+		offset += node_entry_size(node);
+	}
+	for (t = 0; t < elf_classes; t++) {
+		aligned = 0;
+		HASH_ITER(hh, nodes_table, node, nnode) {
+			if (node->type != smashfs_inode_type_regular_file) {
+				continue;
+			}
+			for (e = 0; e < node->regular_file->nextents; e++) {
+				if (node->regular_file->extents[e].class != (int) t) {
+					continue;
+				}
+				if (aligned == 0) {
+					offset = (offset + super.block_size - 1) & ~((long long) super.block_size - 1);
+					aligned = 1;
+				}
+				node->regular_file->extents[e].position = offset;
+				offset += node->regular_file->extents[e].size;
+			}
+		}
+	}
+	if (nsplit > 0) {
+		fprintf(stdout, "  split %lld elf files into %lld extents\n", nsplit, nextents);
+	}
+	buffer_uninit(&entry_buffer);
+	buffer_init(&entry_buffer);
+	length = offset;
+
+	if (dictionary_size > 0) {
+		rc = dictionary_train(&super);
+		if (rc != 0) {
+			fprintf(stderr, "dictionary train failed\n");
+			goto bail;
+		}
+	}
+
+	fprintf(stdout, "  calculating super max/min bits (2/3)\n");
+
+	max_inode_size  = -1;
+	max_inode_block = -1;
+	max_inode_index = -1;
+	max_inode_extents = 0;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		max_inode_size  = MAX(max_inode_size, node->size);
+		max_inode_block = MAX(max_inode_block, node->block);
+		max_inode_index = MAX(max_inode_index, node->index);
+		if (node->type == smashfs_inode_type_regular_file) {
+			max_inode_extents = MAX(max_inode_extents, node->regular_file->nextents);
+		}
+	}
+
+	fprintf(stdout, "  setting super block (2/4)\n");
+
+	super.blocks = (offset + (super.block_size - 1)) >> super.block_log2;
+
+	super.bits.inode.size  = blog(max_inode_size);
+	super.bits.inode.block = blog(max_inode_block);
+	super.bits.inode.index = blog(max_inode_index);
+	super.bits.inode.extents = (max_inode_extents > 0) ? blog(max_inode_extents) : 0;
+
+	fprintf(stdout, "  calculating inode size\n");
+
+	max_inode_size  = 0;
+	max_inode_size += super.bits.inode.type;
+	max_inode_size += super.bits.inode.owner_mode;
+	max_inode_size += super.bits.inode.group_mode;
+	max_inode_size += super.bits.inode.other_mode;
+	max_inode_size += super.bits.inode.uid;
+	max_inode_size += super.bits.inode.gid;
+	max_inode_size += super.bits.inode.ctime;
+	max_inode_size += super.bits.inode.mtime;
+	max_inode_size += super.bits.inode.size;
+	max_inode_size += super.bits.inode.block;
+	max_inode_size += super.bits.inode.index;
+	max_inode_size += super.bits.inode.extents;
+	size = (super.inodes * max_inode_size + 7) / 8;
+
+	fprintf(stdout, "  sorting inodes table by number\n");
+
+	HASH_SRT(hh, nodes_table, nodes_sort_by_number);
+
+	fprintf(stdout, "  filling inodes table\n");
+
+	rc = bitbuffer_init(&bitbuffer, size);
+	if (rc != 0) {
+		fprintf(stderr, "bitbuffer init failed\n");
+		goto bail;
+	}
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.type      , node->type);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.owner_mode, node->owner_mode);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.group_mode, node->group_mode);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.other_mode, node->other_mode);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.uid       , node->uid);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.gid       , node->gid);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.ctime     , node->ctime - super.min.inode.ctime);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.mtime     , node->mtime - super.min.inode.mtime);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.size      , node->size);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.block     , node->block);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.index     , node->index);
+		bitbuffer_putbits(&bitbuffer, super.bits.inode.extents   , (node->type == smashfs_inode_type_regular_file) ? node->regular_file->nextents : 0);
+		if (debug > 2) {
+			fprintf(stdout, "    node: %lld, size: %lld, block: %lld, index: %lld\n", node->number, node->size, node->block, node->index);
+		}
+	}
+	rc = buffer_add(&inode_buffer, bitbuffer_buffer(&bitbuffer), size);
+	if (rc < 0) {
+		fprintf(stdout, "buffer add failed\n");
+		goto bail;
+	}
+	bitbuffer_uninit(&bitbuffer);
+
+	bc = malloc(size * 2);
+	if (bc == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	rc = compressor_compress(compressor, buffer_buffer(&inode_buffer), size, bc, size * 2);
+	if (rc < 0) {
+		fprintf(stderr, "compress failed for inodes table\n");
+		goto bail;
+	}
+	if (rc > size) {
+		fprintf(stderr, "compressed size is bigger than actual size\n");
+		goto bail;
+	}
+	rc = buffer_add(&inode_cbuffer, bc, rc);
+	if (rc < 0) {
+		fprintf(stdout, "buffer add failed\n");
+		goto bail;
+	}
+	free(bc);
+	bc = NULL;
+	fprintf(stdout, "  filling filters table\n");
+
+	/*
+	 * filters table is an array of inodes + 1 byte offsets, indexed by
+	 * inode number, followed by the directory bloom filters. filter of
+	 * inode n spans [offset[n], offset[n + 1]), and is empty for anything
+	 * but non empty directories. it is stored uncompressed, bloom filters
+	 * do not compress.
+	 */
+	max_filter_offset = 0;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		if (node->type == smashfs_inode_type_directory) {
+			max_filter_offset += smashfs_filter_size(node->directory->nentries);
+		}
+	}
+	super.bits.filter.offset = blog(max_filter_offset);
+	size = ((super.inodes + 1) * super.bits.filter.offset + 7) / 8;
+	rc = bitbuffer_init(&bitbuffer, size);
+	if (rc != 0) {
+		fprintf(stderr, "bitbuffer init failed\n");
+		goto bail;
+	}
+	offset = 0;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		bitbuffer_putbits(&bitbuffer, super.bits.filter.offset, offset);
+		if (node->type == smashfs_inode_type_directory) {
+			offset += smashfs_filter_size(node->directory->nentries);
+		}
+	}
+	bitbuffer_putbits(&bitbuffer, super.bits.filter.offset, offset);
+	rc = buffer_add(&filter_buffer, bitbuffer_buffer(&bitbuffer), size);
+	if (rc < 0) {
+		fprintf(stdout, "buffer add failed\n");
+		goto bail;
+	}
+	bitbuffer_uninit(&bitbuffer);
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		if (node->type != smashfs_inode_type_directory) {
+			continue;
+		}
+		size = smashfs_filter_size(node->directory->nentries);
+		if (size == 0) {
+			continue;
+		}
+		filter = malloc(size);
+		if (filter == NULL) {
+			fprintf(stderr, "malloc failed\n");
+			goto bail;
+		}
+		memset(filter, 0, size);
+		for (e = 0; e < node->directory->nentries; e++) {
+			smashfs_filter_add(filter, size, node->directory->entries[e].name, node->directory->entries[e].length);
+		}
+		rc = buffer_add(&filter_buffer, filter, size);
+		if (rc < 0) {
+			fprintf(stdout, "buffer add failed\n");
+			goto bail;
 		}
+		free(filter);
+		filter = NULL;
 	}
 
-	fprintf(stdout, "  calculating super max/min bits (2/3)\n");
+	fprintf(stdout, "  sorting inodes table by type\n");
 
-	max_inode_size  = -1;
-	max_inode_block = -1;
-	max_inode_index = -1;
-	HASH_ITER(hh, nodes_table, node, nnode) {
-		max_inode_size  = MAX(max_inode_size, node->size);
-		max_inode_block = MAX(max_inode_block, node->block);
-		max_inode_index = MAX(max_inode_index, node->index);
+	HASH_SRT(hh, nodes_table, nodes_sort_by_type);
+	stream.node = nodes_table;
+
+	/*
+	 * blocks table is written after the entries are compressed, so space
+	 * is reserved for it with the widest bits it may need. compressed
+	 * blocks are never bigger than their data, blocks that do not shrink
+	 * are stored as they are. per block compression type is only needed
+	 * when candidates other than the image compressor are tried, per block
+	 * bcj filter only when a candidate can apply one to elf files.
+	 */
+	max_block_type = 0;
+	max_node_bcj = 0;
+	for (c = 0; c < ncandidates; c++) {
+		if (compressor_type(candidates[c]) != super.compression_type) {
+			max_block_type = MAX(max_block_type, compressor_type(candidates[c]));
+			max_block_type = MAX(max_block_type, super.compression_type);
+		}
+		if (compressor_supports_bcj(candidates[c])) {
+			for (node = nodes_table; node != NULL; node = node->hh.next) {
+				max_node_bcj = MAX(max_node_bcj, node->bcj);
+			}
+		}
 	}
+	size  = 0;
+	size += blog(length);
+	size += blog(super.block_size);
+	size += 1;
+	size += (max_block_type > 0) ? blog(max_block_type) : 0;
+	size += (max_node_bcj > 0) ? blog(max_node_bcj) : 0;
+	size *= super.blocks;
+	size += blog(super.block_size);
+	size  = (size + 7) / 8;
 
-	fprintf(stdout, "  setting super block (2/4)\n");
-
-	super.blocks = (buffer_length(&entry_buffer) + (super.block_size - 1)) >> super.block_log2;
+	super.inodes_offset  = sizeof(struct smashfs_super_block);
+	super.inodes_size    = buffer_length(&inode_buffer);
+	super.inodes_csize   = buffer_length(&inode_cbuffer);
+	super.filters_offset = super.inodes_offset + super.inodes_csize;
+	super.filters_size   = buffer_length(&filter_buffer);
+	super.dictionary_offset = super.filters_offset + super.filters_size;
+	super.dictionary_size   = dictionary_length;
+	super.blocks_offset  = super.dictionary_offset + super.dictionary_size;
+	super.entries_offset = super.blocks_offset + size;
+
+	fd = open(output, O_CREAT | O_TRUNC | O_RDWR, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "open failed for %s\n", output);
+		goto bail;
+	}
 
-	super.bits.inode.size  = blog(max_inode_size);
-	super.bits.inode.block = blog(max_inode_block);
-	super.bits.inode.index = blog(max_inode_index);
+	nwindow = memory_limit / (super.block_size * 3);
+	nwindow = MAX(nwindow, 1);
+	nwindow = MIN(nwindow, super.blocks);
 
-	fprintf(stdout, "  compressing %d blocks\n", super.blocks);
+	fprintf(stdout, "  compressing %d blocks, %d at a time\n", super.blocks, nwindow);
 
 	blocks = malloc(super.blocks * sizeof(struct block));
 	if (blocks == NULL) {
@@ -524,62 +1889,180 @@ static int output_write (void)
 		goto bail;
 	}
 	memset(blocks, 0, super.blocks * sizeof(struct block));
-	bc = malloc(super.block_size * 2);
+	bb = malloc(nwindow * super.block_size);
+	if (bb == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	bc = malloc(nwindow * super.block_size * 2);
 	if (bc == NULL) {
 		fprintf(stderr, "malloc failed\n");
 		goto bail;
 	}
-	buffer_init(&entry_cbuffer);
-	bb = buffer_buffer(&entry_buffer);
-	for (b = 0; b < super.blocks; b++) {
-		if (debug > 1) {
-			fprintf(stdout, "    compressing block: %d (1/3)\n", b);
+	dedups = malloc(sizeof(struct block_dedup) * super.blocks);
+	if (dedups == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	nblock_duplicates = 0;
+	nblock_zeros = 0;
+	fprintf(stdout, "  compressing with %d job%s\n", njobs, (njobs > 1) ? "s" : "");
+	job_args = malloc(sizeof(struct job_arg) * njobs);
+	if (job_args == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	memset(job_args, 0, sizeof(struct job_arg) * njobs);
+	for (w = 0; w < njobs; w++) {
+		for (c = 0; c < ncandidates; c++) {
+			job_args[w].contexts[c] = compressor_context_create(candidates[c]);
+			if (job_args[w].contexts[c] == NULL) {
+				fprintf(stderr, "compressor context create failed\n");
+				goto bail;
+			}
 		}
-		blocks[b].size = MIN(super.block_size, buffer_length(&entry_buffer) - (bb - ((unsigned char *) buffer_buffer(&entry_buffer))));
-		blocks[b].buffer = bb;
-		blocks[b].cbuffer = malloc(blocks[b].size * 2);
-		if (blocks[b].cbuffer == NULL) {
+		job_args[w].scratch = malloc(super.block_size * 2);
+		if (job_args[w].scratch == NULL) {
 			fprintf(stderr, "malloc failed\n");
 			goto bail;
 		}
-		bb += super.block_size;
 	}
-	job_arg.nblocks = super.blocks;
-	job_arg.blocks = blocks;
-	fprintf(stdout, "  compressing with %d job%s\n", njobs, (njobs > 1) ? "s" : "");
-	for (b = 0; b < njobs; b++) {
-		rc = pthread_create(&jobs[b], NULL, job, &job_arg);
+	memset(&job_queue, 0, sizeof(struct job_queue));
+	pthread_mutex_init(&job_queue.mutex, NULL);
+	pthread_cond_init(&job_queue.cond, NULL);
+	job_queue.nblocks = super.blocks;
+	job_queue.nslots = nwindow;
+	job_queue.fd = fd;
+	job_queue.base = super.entries_offset;
+	job_queue.blocks = blocks;
+	for (n = 0; n < njobs; n++) {
+		job_args[n].queue = &job_queue;
+		rc = job_create(n, job, &job_args[n]);
 		if (rc != 0) {
 			fprintf(stderr, "job create failed\n");
-			goto bail;
+			job_queue_fail(&job_queue);
+			break;
 		}
 	}
-	for (b = 0; b < njobs; b++) {
-		rc = pthread_join(jobs[b], NULL);
+	if (n == njobs) {
+		rc = pthread_create(&writer, NULL, job_writer, &job_queue);
 		if (rc != 0) {
-			fprintf(stderr, "job join failed\n");
-			goto bail;
+			fprintf(stderr, "writer create failed\n");
+			job_queue_fail(&job_queue);
 		}
 	}
-	max_block_offset = 0;
 	for (b = 0; b < super.blocks; b++) {
+		pthread_mutex_lock(&job_queue.mutex);
+		while (b >= job_queue.written + job_queue.nslots && job_queue.error == 0) {
+			pthread_cond_wait(&job_queue.cond, &job_queue.mutex);
+		}
+		if (job_queue.error != 0) {
+			pthread_mutex_unlock(&job_queue.mutex);
+			break;
+		}
+		pthread_mutex_unlock(&job_queue.mutex);
 		if (debug > 1) {
-			fprintf(stdout, "    compressing block: %d (3/3)\n", b);
+			fprintf(stdout, "    compressing block: %d (1/3)\n", b);
 		}
-		blocks[b].offset = max_block_offset;
-		rc = buffer_add(&entry_cbuffer, blocks[b].cbuffer, blocks[b].compressed_size);
-		if (rc != blocks[b].compressed_size) {
-			fprintf(stderr, "buffer add failed\n");
-			goto bail;
+		w = b % nwindow;
+		blocks[b].buffer = bb + w * super.block_size;
+		blocks[b].cbuffer = bc + w * super.block_size * 2;
+		memset(stream.bcj, 0, sizeof(stream.bcj));
+		blocks[b].size = entry_stream_read(&stream, blocks[b].buffer, super.block_size);
+		if (blocks[b].size != MIN(super.block_size, length - (long long) b * super.block_size)) {
+			fprintf(stderr, "entry stream read failed\n");
+			job_queue_fail(&job_queue);
+			break;
+		}
+		blocks[b].bcj = 0;
+		for (t = 1; t < SMASHFS_BCJ_TYPES; t++) {
+			if (stream.bcj[t] * 2 > blocks[b].size) {
+				blocks[b].bcj = t;
+			}
+		}
+		blocks[b].duplicate = -1;
+		blocks[b].zero = block_zero(blocks[b].buffer, blocks[b].size);
+		if (blocks[b].zero) {
+			nblock_zeros += 1;
+		} else if (no_duplicates == 0) {
+			dedup = &dedups[b];
+			dedup->key.hash = hash_buffer(blocks[b].buffer, blocks[b].size, 0);
+			dedup->key.size = blocks[b].size;
+			dedup->block = b;
+			HASH_FIND(hh, dedup_table, &dedup->key, sizeof(dedup->key), original);
+			if (original == NULL) {
+				HASH_ADD(hh, dedup_table, key, sizeof(dedup->key), dedup);
+			} else if (b - original->block < nwindow) {
+				if (memcmp(bb + (original->block % nwindow) * super.block_size, blocks[b].buffer, blocks[b].size) == 0) {
+					blocks[b].duplicate = original->block;
+				}
+			} else {
+				if (block_compare_output(&job_queue, original->block, blocks[b].buffer, blocks[b].size) == 0) {
+					blocks[b].duplicate = original->block;
+				}
+			}
+			if (blocks[b].duplicate >= 0) {
+				nblock_duplicates += 1;
+			}
 		}
-		max_block_offset += rc;
+		pthread_mutex_lock(&job_queue.mutex);
+		job_queue.packed = b + 1;
+		pthread_cond_broadcast(&job_queue.cond);
+		pthread_mutex_unlock(&job_queue.mutex);
+	}
+	if (n == njobs && rc == 0) {
+		pthread_join(writer, NULL);
+	}
+	HASH_CLEAR(hh, dedup_table);
+	free(dedups);
+	dedups = NULL;
+	while (n > 0) {
+		pthread_join(jobs[--n], NULL);
+	}
+	pthread_cond_destroy(&job_queue.cond);
+	pthread_mutex_destroy(&job_queue.mutex);
+	if (job_queue.error != 0) {
+		goto bail;
 	}
-	for (b = 0; b < super.blocks; b++) {
-		if (blocks[b].status != 2) {
-			fprintf(stderr, "logic error\n");
-			goto bail;
+	max_block_offset = job_queue.offset;
+	super.entries_size = max_block_offset;
+	if (nblock_duplicates > 0) {
+		fprintf(stdout, "    %lld duplicate blocks\n", nblock_duplicates);
+	}
+	if (nblock_zeros > 0) {
+		fprintf(stdout, "    %lld zero blocks\n", nblock_zeros);
+	}
+	for (w = 0; w < njobs; w++) {
+		fprintf(stdout, "    job %d: %llu blocks, %llu stored, %llu bcj, %llu -> %llu bytes, %llu ms\n", w,
+				job_args[w].stat.blocks,
+				job_args[w].stat.stored,
+				job_args[w].stat.bcj,
+				job_args[w].stat.size,
+				job_args[w].stat.compressed_size,
+				job_args[w].stat.usecs / 1000);
+	}
+	for (w = 0; w < njobs; w++) {
+		for (c = 0; c < ncandidates; c++) {
+			compressor_context_destroy(job_args[w].contexts[c]);
+			job_args[w].contexts[c] = NULL;
+		}
+		free(job_args[w].scratch);
+		job_args[w].scratch = NULL;
+	}
+	if (ncandidates > 1) {
+		for (c = 0; c < ncandidates; c++) {
+			for (n = 0, b = 0; b < super.blocks; b++) {
+				if (blocks[b].stored == 0 && blocks[b].type == (int) compressor_type(candidates[c])) {
+					n += 1;
+				}
+			}
+			fprintf(stdout, "    %s: %u blocks\n", compressor_name(candidates[c]), n);
 		}
 	}
+	free(bb);
+	bb = NULL;
+	free(bc);
+	bc = NULL;
 
 	fprintf(stdout, "  calculating super max/min bits (3/3)\n");
 
@@ -587,7 +2070,22 @@ static int output_write (void)
 	max_block_size            = -1;
 	max_block_compressed_size = -1;
 	min_block_compressed_size = LONG_LONG_MAX;
+	max_block_type            = 0;
+	max_block_bcj             = 0;
+	super.bits.block.stored   = 0;
+	super.compression_types   = 1 << super.compression_type;
+	super.bcj_types           = 0;
 	for (b = 0; b < super.blocks; b++) {
+		if (blocks[b].stored) {
+			super.bits.block.stored = 1;
+		} else {
+			super.compression_types |= 1 << blocks[b].type;
+			max_block_type = MAX(max_block_type, blocks[b].type);
+		}
+		if (blocks[b].bcj != 0) {
+			super.bcj_types |= 1 << blocks[b].bcj;
+			max_block_bcj = MAX(max_block_bcj, blocks[b].bcj);
+		}
 		max_block_offset          = MAX(max_block_offset, blocks[b].offset);
 		max_block_compressed_size = MAX(max_block_compressed_size, blocks[b].compressed_size);
 		min_block_compressed_size = MIN(min_block_compressed_size, blocks[b].compressed_size);
@@ -600,14 +2098,24 @@ static int output_write (void)
 	super.bits.block.size            = blog(max_block_size);
 	super.bits.block.compressed_size = blog(max_block_compressed_size - min_block_compressed_size);
 	super.min.block.compressed_size  = min_block_compressed_size;
+	super.bits.block.type            = (super.compression_types != (1U << super.compression_type)) ? blog(max_block_type) : 0;
+	super.bits.block.bcj             = (max_block_bcj > 0) ? blog(max_block_bcj) : 0;
 
 	size  = 0;
 	size += super.bits.block.offset;
 	size += super.bits.block.compressed_size;
+	size += super.bits.block.stored;
+	size += super.bits.block.type;
+	size += super.bits.block.bcj;
 	size *= super.blocks;
 	size += super.bits.block.size;
 	size = (size + 7) / 8;
 
+	if (super.blocks_offset + size > super.entries_offset) {
+		fprintf(stderr, "logic error, blocks table does not fit\n");
+		goto bail;
+	}
+
 	rc = bitbuffer_init(&bitbuffer, size);
 	if (rc != 0) {
 		fprintf(stderr, "bitbuffer init failed\n");
@@ -616,6 +2124,9 @@ static int output_write (void)
 	for (b = 0; b < super.blocks; b++) {
 		bitbuffer_putbits(&bitbuffer, super.bits.block.offset, blocks[b].offset);
 		bitbuffer_putbits(&bitbuffer, super.bits.block.compressed_size, blocks[b].compressed_size - min_block_compressed_size);
+		bitbuffer_putbits(&bitbuffer, super.bits.block.stored, blocks[b].stored);
+		bitbuffer_putbits(&bitbuffer, super.bits.block.type, blocks[b].type);
+		bitbuffer_putbits(&bitbuffer, super.bits.block.bcj, blocks[b].bcj);
 	}
 	bitbuffer_putbits(&bitbuffer, super.bits.block.size, blocks[b - 1].size);
 	buffer_init(&block_buffer);
@@ -626,86 +2137,9 @@ static int output_write (void)
 	}
 	bitbuffer_uninit(&bitbuffer);
 
-	fprintf(stdout, "  calculating inode size\n");
-
-	max_inode_size  = 0;
-	max_inode_size += super.bits.inode.type;
-	max_inode_size += super.bits.inode.owner_mode;
-	max_inode_size += super.bits.inode.group_mode;
-	max_inode_size += super.bits.inode.other_mode;
-	max_inode_size += super.bits.inode.uid;
-	max_inode_size += super.bits.inode.gid;
-	max_inode_size += super.bits.inode.ctime;
-	max_inode_size += super.bits.inode.mtime;
-	max_inode_size += super.bits.inode.size;
-	max_inode_size += super.bits.inode.block;
-	max_inode_size += super.bits.inode.index;
-	size = (super.inodes * max_inode_size + 7) / 8;
-
-	fprintf(stdout, "  sorting inodes table by number\n");
-
-	HASH_SRT(hh, nodes_table, nodes_sort_by_number);
-
-	fprintf(stdout, "  filling inodes table\n");
-
-	rc = bitbuffer_init(&bitbuffer, size);
-	if (rc != 0) {
-		fprintf(stderr, "bitbuffer init failed\n");
-		goto bail;
-	}
-	HASH_ITER(hh, nodes_table, node, nnode) {
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.type      , node->type);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.owner_mode, node->owner_mode);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.group_mode, node->group_mode);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.other_mode, node->other_mode);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.uid       , node->uid);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.gid       , node->gid);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.ctime     , node->ctime - super.min.inode.ctime);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.mtime     , node->mtime - super.min.inode.mtime);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.size      , node->size);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.block     , node->block);
-		bitbuffer_putbits(&bitbuffer, super.bits.inode.index     , node->index);
-		if (debug > 2) {
-			fprintf(stdout, "    node: %lld, size: %lld, block: %lld, index: %lld\n", node->number, node->size, node->block, node->index);
-		}
-	}
-	rc = buffer_add(&inode_buffer, bitbuffer_buffer(&bitbuffer), size);
-	if (rc < 0) {
-		fprintf(stdout, "buffer add failed\n");
-		goto bail;
-	}
-	bitbuffer_uninit(&bitbuffer);
-
-	free(bc);
-	bc = malloc(size * 2);
-	if (bc == NULL) {
-		fprintf(stderr, "malloc failed\n");
-		goto bail;
-	}
-	rc = compressor_compress(compressor, buffer_buffer(&inode_buffer), size, bc, size * 2);
-	if (rc < 0) {
-		fprintf(stderr, "compress failed for inodes table\n");
-		goto bail;
-	}
-	if (rc > size) {
-		fprintf(stderr, "compressed size is bigger than actual size\n");
-		goto bail;
-	}
-	rc = buffer_add(&inode_cbuffer, bc, rc);
-	if (rc < 0) {
-		fprintf(stdout, "buffer add failed\n");
-		goto bail;
-	}
-
 	fprintf(stdout, "  setting super block (4/4)\n");
 
-	super.inodes_offset  = sizeof(struct smashfs_super_block);
-	super.inodes_size    = buffer_length(&inode_buffer);
-	super.inodes_csize   = buffer_length(&inode_cbuffer);
-	super.blocks_offset  = super.inodes_offset + super.inodes_csize;
 	super.blocks_size    = buffer_length(&block_buffer);
-	super.entries_offset = super.blocks_offset + super.blocks_size;
-	super.entries_size   = buffer_length(&entry_cbuffer);
 
 	fprintf(stdout, "  filling super block\n");
 
@@ -722,10 +2156,17 @@ static int output_write (void)
 		fprintf(stdout, "    inodes_offset : 0x%08x, %u\n", super.inodes_offset, super.inodes_offset);
 		fprintf(stdout, "    inodes_size   : 0x%08x, %u\n", super.inodes_size, super.inodes_size);
 		fprintf(stdout, "    inodes_csize  : 0x%08x, %u\n", super.inodes_size, super.inodes_csize);
+		fprintf(stdout, "    filters_offset: 0x%08x, %u\n", super.filters_offset, super.filters_offset);
+		fprintf(stdout, "    filters_size  : 0x%08x, %u\n", super.filters_size, super.filters_size);
 		fprintf(stdout, "    blocks_offset : 0x%08x, %u\n", super.blocks_offset, super.blocks_offset);
 		fprintf(stdout, "    blocks_size   : 0x%08x, %u\n", super.blocks_size, super.blocks_size);
 		fprintf(stdout, "    entries_offset: 0x%08x, %u\n", super.entries_offset, super.entries_offset);
 		fprintf(stdout, "    entries_size  : 0x%08x, %u\n", super.entries_size, super.entries_size);
+		fprintf(stdout, "    compression   : 0x%08x, %u\n", super.compression_type, super.compression_type);
+		fprintf(stdout, "    compressions  : 0x%08x, %u\n", super.compression_types, super.compression_types);
+		fprintf(stdout, "    dictionary_offset: 0x%08x, %u\n", super.dictionary_offset, super.dictionary_offset);
+		fprintf(stdout, "    dictionary_size  : 0x%08x, %u\n", super.dictionary_size, super.dictionary_size);
+		fprintf(stdout, "    bcj_types        : 0x%08x, %u\n", super.bcj_types, super.bcj_types);
 		fprintf(stdout, "    bits:\n");
 		fprintf(stdout, "      min:\n");
 		fprintf(stdout, "        inode:\n");
@@ -745,10 +2186,12 @@ static int output_write (void)
 		fprintf(stdout, "        size      : %u\n", super.bits.inode.size);
 		fprintf(stdout, "        block     : %u\n", super.bits.inode.block);
 		fprintf(stdout, "        index     : %u\n", super.bits.inode.index);
+		fprintf(stdout, "        extents   : %u\n", super.bits.inode.extents);
 		fprintf(stdout, "        regular_file:\n");
 		fprintf(stdout, "        directory:\n");
 		fprintf(stdout, "          parent   : %u\n", super.bits.inode.directory.parent);
 		fprintf(stdout, "          nentries : %u\n", super.bits.inode.directory.nentries);
+		fprintf(stdout, "          index    : %u\n", super.bits.inode.directory.index);
 		fprintf(stdout, "          entries:\n");
 		fprintf(stdout, "            number : %u\n", super.bits.inode.directory.entries.number);
 		fprintf(stdout, "            length : %u\n", super.bits.inode.directory.entries.length);
@@ -758,6 +2201,11 @@ static int output_write (void)
 		fprintf(stdout, "        offset         : %u\n", super.bits.block.offset);
 		fprintf(stdout, "        compressed_size: %u\n", super.bits.block.compressed_size);
 		fprintf(stdout, "        size           : %u\n", super.bits.block.size);
+		fprintf(stdout, "        stored         : %u\n", super.bits.block.stored);
+		fprintf(stdout, "        type           : %u\n", super.bits.block.type);
+		fprintf(stdout, "        bcj            : %u\n", super.bits.block.bcj);
+		fprintf(stdout, "      filter:\n");
+		fprintf(stdout, "        offset         : %u\n", super.bits.filter.offset);
 	}
 
 	buffer_init(&super_buffer);
@@ -771,122 +2219,218 @@ static int output_write (void)
 	fprintf(stdout, "    super: %lld bytes\n", buffer_length(&super_buffer));
 	fprintf(stdout, "    inode: %lld bytes\n", buffer_length(&inode_buffer));
 	fprintf(stdout, "           %lld bytes\n", buffer_length(&inode_cbuffer));
+	fprintf(stdout, "    filter: %lld bytes\n", buffer_length(&filter_buffer));
 	fprintf(stdout, "    block: %lld bytes\n", buffer_length(&block_buffer));
-	fprintf(stdout, "    entry: %lld bytes\n", buffer_length(&entry_buffer));
-	fprintf(stdout, "           %lld bytes\n", buffer_length(&entry_cbuffer));
-	fprintf(stdout, "    total: %lld bytes\n", buffer_length(&super_buffer) + buffer_length(&inode_cbuffer) + buffer_length(&block_buffer) + buffer_length(&entry_cbuffer));
-
-	fd = open(output, O_CREAT | O_TRUNC | O_WRONLY, 0666);
-	if (fd < 0) {
-		fprintf(stderr, "open failed for %s\n", output);
-		goto bail;
-	}
-
-	total = 0;
+	fprintf(stdout, "    entry: %lld bytes\n", length);
+	fprintf(stdout, "           %u bytes\n", super.entries_size);
+	fprintf(stdout, "    total: %lld bytes\n", (long long) super.entries_offset + super.entries_size);
 
-	rc = write(fd, buffer_buffer(&super_buffer), buffer_length(&super_buffer));
-	if (rc != buffer_length(&super_buffer)) {
-		fprintf(stderr, "write failed\n");
+	rc = output_pwrite(fd, buffer_buffer(&inode_cbuffer), buffer_length(&inode_cbuffer), super.inodes_offset);
+	if (rc != 0) {
 		goto bail;
 	}
-	total += rc;
 
-	rc = write(fd, buffer_buffer(&inode_cbuffer), buffer_length(&inode_cbuffer));
-	if (rc != buffer_length(&inode_cbuffer)) {
-		fprintf(stderr, "write failed\n");
+	rc = output_pwrite(fd, buffer_buffer(&filter_buffer), buffer_length(&filter_buffer), super.filters_offset);
+	if (rc != 0) {
 		goto bail;
 	}
-	total += rc;
 
-	rc = write(fd, buffer_buffer(&block_buffer), buffer_length(&block_buffer));
-	if (rc != buffer_length(&block_buffer)) {
-		fprintf(stderr, "write failed\n");
+	rc = output_pwrite(fd, dictionary, super.dictionary_size, super.dictionary_offset);
+	if (rc != 0) {
 		goto bail;
 	}
-	total += rc;
 
-	rc = write(fd, buffer_buffer(&entry_cbuffer), buffer_length(&entry_cbuffer));
-	if (rc != buffer_length(&entry_cbuffer)) {
-		fprintf(stderr, "write failed\n");
+	rc = output_pwrite(fd, buffer_buffer(&block_buffer), buffer_length(&block_buffer), super.blocks_offset);
+	if (rc != 0) {
 		goto bail;
 	}
-	total += rc;
 
+	total = super.entries_offset + super.entries_size;
 	if ((no_padding == 0) && (index = total & (4096 - 1))) {
 		char tmp[4096] = { 0 };
-		rc = write(fd, tmp, 4096 - index);
-		if (rc != 4096 - index) {
-			fprintf(stderr, "write failed\n");
+		rc = output_pwrite(fd, tmp, 4096 - index, total);
+		if (rc != 0) {
 			goto bail;
 		}
 	}
 
+	rc = output_pwrite(fd, buffer_buffer(&super_buffer), buffer_length(&super_buffer), 0);
+	if (rc != 0) {
+		goto bail;
+	}
+
 	close(fd);
+	free(bb);
 	free(bc);
-	for (b = 0; blocks != NULL && b < super.blocks; b++) {
-		free(blocks[b].cbuffer);
-		blocks[b].cbuffer = NULL;
-	}
 	free(blocks);
-	buffer_uninit(&entry_cbuffer);
+	free(job_args);
+	entry_stream_uninit(&stream);
 	buffer_uninit(&inode_cbuffer);
 	buffer_uninit(&super_buffer);
 	buffer_uninit(&inode_buffer);
+	buffer_uninit(&filter_buffer);
 	buffer_uninit(&block_buffer);
 	buffer_uninit(&entry_buffer);
 	return 0;
 
 bail:
 	close(fd);
+	free(bb);
 	free(bc);
-	for (b = 0; blocks != NULL && b < super.blocks; b++) {
-		free(blocks[b].cbuffer);
-		blocks[b].cbuffer = NULL;
-	}
+	free(filter);
 	free(blocks);
+	HASH_CLEAR(hh, dedup_table);
+	free(dedups);
+	if (job_args != NULL) {
+		for (w = 0; w < njobs; w++) {
+			for (c = 0; c < ncandidates; c++) {
+				compressor_context_destroy(job_args[w].contexts[c]);
+			}
+			free(job_args[w].scratch);
+		}
+	}
+	free(job_args);
+	entry_stream_uninit(&stream);
 	bitbuffer_uninit(&bitbuffer);
-	buffer_uninit(&entry_cbuffer);
 	buffer_uninit(&inode_cbuffer);
 	buffer_uninit(&super_buffer);
 	buffer_uninit(&inode_buffer);
+	buffer_uninit(&filter_buffer);
 	buffer_uninit(&block_buffer);
 	buffer_uninit(&entry_buffer);
 	return -1;
 }
 
+/*
+ * compares contents of two files of the same size, a chunk at a time, so
+ * file data never has to be resident.
+ */
+static int file_compare (const char *a, const char *b, long long size)
+{
+	int rc;
+	int fa;
+	int fb;
+	ssize_t ra;
+	ssize_t rb;
+	unsigned char ba[64 * 1024];
+	unsigned char bb[64 * 1024];
+	rc = -1;
+	fa = -1;
+	fb = -1;
+	fa = open(a, O_RDONLY);
+	if (fa < 0) {
+		fprintf(stderr, "open failed for %s\n", a);
+		goto out;
+	}
+	fb = open(b, O_RDONLY);
+	if (fb < 0) {
+		fprintf(stderr, "open failed for %s\n", b);
+		goto out;
+	}
+	while (size > 0) {
+		ra = read(fa, ba, MIN(size, (long long) sizeof(ba)));
+		rb = read(fb, bb, MIN(size, (long long) sizeof(bb)));
+		if (ra <= 0 || ra != rb) {
+			goto out;
+		}
+		if (memcmp(ba, bb, ra) != 0) {
+			goto out;
+		}
+		size -= ra;
+	}
+	rc = 0;
+out:
+	if (fa >= 0) {
+		close(fa);
+	}
+	if (fb >= 0) {
+		close(fb);
+	}
+	return rc;
+}
+
 static int node_delete (struct node *node)
 {
 	HASH_DEL(nodes_table, node);
-	free(node->pointer);
-	free(node);
+	if (node->type == smashfs_inode_type_directory) {
+		free(node->directory->entries);
+	}
 	return 0;
 }
 
-static struct node * node_new (FTSENT *entry)
+/*
+ * directory entries are kept in a vector that grows geometrically, sized
+ * up front from the number of entries the scan found, so building a
+ * directory is linear in its number of entries.
+ */
+static int node_directory_reserve (struct node_directory *directory, long long size)
 {
-	int fd;
-	ssize_t r;
-	long long e;
-	long long s;
-	int duplicate;
+	struct node_directory_entry *entries;
+	if (size <= directory->size) {
+		return 0;
+	}
+	entries = realloc(directory->entries, sizeof(struct node_directory_entry) * size);
+	if (entries == NULL) {
+		fprintf(stderr, "realloc failed\n");
+		return -1;
+	}
+	directory->entries = entries;
+	directory->size = size;
+	return 0;
+}
+
+/*
+ * bcj filter matching the machine of an elf file, e_machine follows the
+ * identification bytes in the byte order of the file.
+ */
+static long long elf_bcj (const unsigned char *magic)
+{
+	unsigned int machine;
+	if (magic[EI_DATA] == ELFDATA2MSB) {
+		machine = (magic[EI_NIDENT + 2] << 8) | magic[EI_NIDENT + 3];
+	} else {
+		machine = (magic[EI_NIDENT + 3] << 8) | magic[EI_NIDENT + 2];
+	}
+	switch (machine) {
+		case EM_386:
+		case EM_X86_64:
+			return smashfs_bcj_type_x86;
+		case EM_PPC:
+		case EM_PPC64:
+			return (magic[EI_DATA] == ELFDATA2MSB) ? smashfs_bcj_type_powerpc : smashfs_bcj_type_none;
+		case EM_IA_64:
+			return smashfs_bcj_type_ia64;
+		case EM_ARM:
+			return smashfs_bcj_type_arm;
+		case EM_SPARC:
+		case EM_SPARCV9:
+			return smashfs_bcj_type_sparc;
+		case EM_AARCH64:
+			return smashfs_bcj_type_arm64;
+#if defined(EM_RISCV)
+		case EM_RISCV:
+			return smashfs_bcj_type_riscv;
+#endif
+	}
+	return smashfs_bcj_type_none;
+}
+
+static struct node * node_new (struct scan_entry *entry, struct node *parent)
+{
+	int rc;
 	struct node *node;
 	struct stat *stbuf;
-	struct node *dnode;
-	struct node *ndnode;
-	struct node *parent;
 	struct node_directory *directory;
 	struct node_directory_entry *directory_entry;
-	fd = -1;
-	duplicate = 0;
-	stbuf = entry->fts_statp;
-	node = malloc(sizeof(struct node));
+	stbuf = &entry->stbuf;
+	node = arena_alloc(&nodes_arena, sizeof(struct node));
 	if (node == NULL) {
-		fprintf(stderr, "malloc failed\n");
+		fprintf(stderr, "arena alloc failed\n");
 		return NULL;
 	}
-	entry->fts_pointer = node;
 	node->number = nodes_id;
 	node->pointer = NULL;
+	node->bcj = smashfs_bcj_type_none;
 	if (S_ISREG(stbuf->st_mode)) {
 		node->type = smashfs_inode_type_regular_file;
 	} else if (S_ISDIR(stbuf->st_mode)) {
@@ -903,7 +2447,6 @@ static struct node * node_new (FTSENT *entry)
 		node->type = smashfs_inode_type_socket;
 	} else {
 		fprintf(stderr, "unknown mode: 0x%08x\n", stbuf->st_mode);
-		free(node);
 		return NULL;
 	}
 	node->owner_mode = 0;
@@ -940,104 +2483,60 @@ static struct node * node_new (FTSENT *entry)
 	node->gid = stbuf->st_gid;
 	node->ctime = stbuf->st_ctime;
 	node->mtime = stbuf->st_mtime;
-	snprintf(node->path, sizeof(node->path), "%s", entry->fts_accpath);
+	node->parent = parent;
+	node->name = arena_strdup(&nodes_arena, entry->name);
+	if (node->name == NULL) {
+		fprintf(stderr, "arena strdup failed\n");
+		goto bail;
+	}
 	if (node->type == smashfs_inode_type_regular_file) {
 		node->ntype = node_type_regular_file;
-		fd = open(entry->fts_accpath, O_RDONLY);
-		if (fd < 0) {
-			fprintf(stderr, "open failed\n");
-			goto bail;
-		}
-		node->regular_file = malloc(sizeof(struct node_regular_file) + stbuf->st_size);
-		if (node->regular_file == NULL) {
-			fprintf(stderr, "malloc failed\n");
-			goto bail;
-		}
-		node->regular_file->size = stbuf->st_size;
-		r = read(fd, node->regular_file->content, node->regular_file->size);
-		if (r != (ssize_t) node->regular_file->size) {
-			fprintf(stderr, "read failed path: %s, size %lld, ret: %zd\n", entry->fts_accpath, node->regular_file->size, r);
-			goto bail;
-		}
-		if (node->regular_file->size >= 4) {
-			if ((node->regular_file->content[0] == 0x7f) &&
-			    (node->regular_file->content[1] == 0x45) &&
-			    (node->regular_file->content[2] == 0x4c) &&
-			    (node->regular_file->content[3] == 0x46)) {
-				node->ntype = node_type_elf_file;
-			}
-		}
-		if (no_duplicates == 0) {
-			HASH_ITER(hh, nodes_table, dnode, ndnode) {
-				if (dnode->type != smashfs_inode_type_regular_file) {
-					continue;
-				}
-				if (dnode->regular_file->size != node->regular_file->size) {
-					continue;
-				}
-				if (memcmp(dnode->regular_file->content, node->regular_file->content, node->regular_file->size) != 0) {
-					continue;
-				}
-				free(node->pointer);
-				free(node);
-				node = dnode;
-				duplicate = 1;
-				break;
-			}
+		node->regular_file = arena_alloc(&nodes_arena, sizeof(struct node_regular_file));
+		if (node->regular_file == NULL) {
+			fprintf(stderr, "arena alloc failed\n");
+			goto bail;
+		}
+		node->regular_file->size = stbuf->st_size;
+		node->regular_file->nextents = 0;
+		node->regular_file->extents = NULL;
+		if ((entry->magic[0] == 0x7f) &&
+		    (entry->magic[1] == 0x45) &&
+		    (entry->magic[2] == 0x4c) &&
+		    (entry->magic[3] == 0x46)) {
+			node->ntype = node_type_elf_file;
+			node->bcj = elf_bcj(entry->magic);
 		}
-		close(fd);
-		fd = -1;
 	} else if (node->type == smashfs_inode_type_directory) {
 		node->ntype = node_type_directory;
-		node->directory = malloc(sizeof(struct node_directory));
+		node->directory = arena_alloc(&nodes_arena, sizeof(struct node_directory));
 		if (node->directory == NULL) {
-			fprintf(stderr, "malloc failed\n");
+			fprintf(stderr, "arena alloc failed\n");
 			goto bail;
 		}
 		node->directory->parent = 0;
 		node->directory->nentries = 0;
-		parent = entry->fts_parent->fts_pointer;
+		node->directory->size = 0;
+		node->directory->entries = NULL;
+		rc = node_directory_reserve(node->directory, entry->nentries);
+		if (rc != 0) {
+			goto bail;
+		}
 		if (parent == NULL) {
 			goto out;
 		}
 		node->directory->parent = parent->number;
 	} else if (node->type == smashfs_inode_type_symbolic_link) {
 		node->ntype = node_type_symbolic_link;
-		node->symbolic_link = malloc(sizeof(struct node_symbolic_link) + stbuf->st_size + 1);
+		node->symbolic_link = arena_alloc(&nodes_arena, sizeof(struct node_symbolic_link) + strlen(entry->link) + 1);
 		if (node->symbolic_link == NULL) {
-			fprintf(stderr, "malloc failed\n");
-			goto bail;
-		}
-		r = readlink(entry->fts_accpath, node->symbolic_link->path, stbuf->st_size);
-		if (r < 0) {
-			fprintf(stderr, "readlink failed\n");
-			goto bail;
-		}
-		if (r > stbuf->st_size) {
-			fprintf(stderr, "readlink failed\n");
+			fprintf(stderr, "arena alloc failed\n");
 			goto bail;
 		}
-		node->symbolic_link->path[r] = '\0';
-		if (no_duplicates == 0) {
-			HASH_ITER(hh, nodes_table, dnode, ndnode) {
-				if (dnode->type != smashfs_inode_type_symbolic_link) {
-					continue;
-				}
-				if (strcmp(dnode->symbolic_link->path, node->symbolic_link->path) != 0) {
-					continue;
-				}
-				free(node->pointer);
-				free(node);
-				node = dnode;
-				duplicate = 1;
-				break;
-			}
-		}
+		strcpy(node->symbolic_link->path, entry->link);
 	} else {
 		fprintf(stderr, "unknown node type: %lld\n", node->type);
 		goto bail;
 	}
-	parent = entry->fts_parent->fts_pointer;
 	if (parent == NULL) {
 		goto out;
 	}
@@ -1046,32 +2545,21 @@ static struct node * node_new (FTSENT *entry)
 		goto bail;
 	}
 	directory = parent->directory;
-	s = sizeof(struct node_directory);
-	for (e = 0; e < directory->nentries; e++) {
-		directory_entry = (struct node_directory_entry *) (((unsigned char *) directory) + s);
-		s += sizeof(struct node_directory_entry) + directory_entry->length;
-	}
-	directory = malloc(s + sizeof(struct node_directory_entry) + strlen(entry->fts_name));
-	if (directory == NULL) {
-		fprintf(stderr, "malloc failed\n");
-		goto bail;
+	if (directory->nentries + 1 > directory->size) {
+		rc = node_directory_reserve(directory, directory->size * 2 + 16);
+		if (rc != 0) {
+			goto bail;
+		}
 	}
-	memcpy(directory, parent->directory, s);
-	directory_entry = (struct node_directory_entry *) (((unsigned char *) directory) + s);
+	directory_entry = &directory->entries[directory->nentries];
 	directory_entry->number = node->number;
-	directory_entry->length = strlen(entry->fts_name);
+	directory_entry->length = strlen(node->name);
 	directory_entry->type   = node->type;
-	memcpy(directory_entry->name, entry->fts_name, strlen(entry->fts_name));
+	directory_entry->name   = node->name;
 	directory->nentries += 1;
-	free(parent->directory);
-	parent->directory = directory;
 out:
-	if (duplicate == 0) {
-		HASH_ADD(hh, nodes_table, number, sizeof(node->number), node);
-		nodes_id += 1;
-	} else {
-		nduplicates += 1;
-	}
+	HASH_ADD(hh, nodes_table, number, sizeof(node->number), node);
+	nodes_id += 1;
 	if (node->type == smashfs_inode_type_regular_file) {
 		nregular_files += 1;
 	}
@@ -1083,113 +2571,600 @@ out:
 	}
 	return node;
 bail:
-	close(fd);
-	if (duplicate == 0) {
-		free(node->pointer);
-		free(node);
+	if (node->type == smashfs_inode_type_directory &&
+	    node->directory != NULL) {
+		free(node->directory->entries);
 	}
 	return NULL;
 }
 
-static int fts_compare (const FTSENT **a, const FTSENT **b)
+/*
+ * source trees are walked by the job threads. a job takes a directory from
+ * the shared queue, reads and stats its entries, reads the elf magic of
+ * regular files and the targets of symbolic links, sorts the entries by
+ * name, and queues the subdirectories. nodes are then created in a single
+ * depth first pass over the sorted tree, so numbering does not depend on
+ * the order the jobs finished in.
+ */
+
+static int scan_entry_compare (const void *a, const void *b)
 {
-	return strcmp((*a)->fts_name, (*b)->fts_name);
+	return strcmp((*(struct scan_entry **) a)->name, (*(struct scan_entry **) b)->name);
 }
 
-static void sources_scan (void)
+static void scan_entry_free (struct scan_entry *entry)
+{
+	unsigned int e;
+	for (e = 0; e < entry->nentries; e++) {
+		scan_entry_free(entry->entries[e]);
+	}
+	free(entry->entries);
+	free(entry->link);
+	free(entry->path);
+	free(entry);
+}
+
+static int scan_queue_push (struct scan_queue *queue, struct scan_entry *entry)
+{
+	struct scan_entry **entries;
+	if (queue->nentries + 1 > queue->size) {
+		entries = realloc(queue->entries, sizeof(struct scan_entry *) * (queue->size * 2 + 16));
+		if (entries == NULL) {
+			fprintf(stderr, "realloc failed\n");
+			return -1;
+		}
+		queue->entries = entries;
+		queue->size = queue->size * 2 + 16;
+	}
+	queue->entries[queue->nentries++] = entry;
+	return 0;
+}
+
+static int scan_entry_fill (struct scan_entry *entry, int dfd, const char *name)
+{
+	int fd;
+	ssize_t r;
+	ssize_t s;
+	memset(entry->magic, 0, sizeof(entry->magic));
+	if (S_ISREG(entry->stbuf.st_mode) && entry->stbuf.st_size >= 4) {
+		fd = openat(dfd, name, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "open failed for %s\n", entry->path);
+			return -1;
+		}
+		s = MIN(entry->stbuf.st_size, (long long) sizeof(entry->magic));
+		r = read(fd, entry->magic, s);
+		close(fd);
+		if (r != s) {
+			fprintf(stderr, "read failed path: %s, size %lld, ret: %zd\n", entry->path, (long long) entry->stbuf.st_size, r);
+			return -1;
+		}
+	} else if (S_ISLNK(entry->stbuf.st_mode)) {
+		entry->link = malloc(entry->stbuf.st_size + 1);
+		if (entry->link == NULL) {
+			fprintf(stderr, "malloc failed\n");
+			return -1;
+		}
+		r = readlinkat(dfd, name, entry->link, entry->stbuf.st_size);
+		if (r < 0 || r > entry->stbuf.st_size) {
+			fprintf(stderr, "readlink failed for %s\n", entry->path);
+			return -1;
+		}
+		entry->link[r] = '\0';
+	}
+	return 0;
+}
+
+static struct scan_entry * scan_entry_new (const char *parent, const char *name)
+{
+	size_t l;
+	struct scan_entry *entry;
+	entry = malloc(sizeof(struct scan_entry));
+	if (entry == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		return NULL;
+	}
+	memset(entry, 0, sizeof(struct scan_entry));
+	if (parent == NULL) {
+		entry->path = strdup(name);
+		if (entry->path == NULL) {
+			fprintf(stderr, "strdup failed\n");
+			free(entry);
+			return NULL;
+		}
+		entry->name = entry->path;
+		return entry;
+	}
+	l = strlen(parent);
+	entry->path = malloc(l + 1 + strlen(name) + 1);
+	if (entry->path == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		free(entry);
+		return NULL;
+	}
+	sprintf(entry->path, "%s/%s", parent, name);
+	entry->name = entry->path + l + 1;
+	return entry;
+}
+
+static void scan_directory (struct scan_queue *queue, struct scan_entry *directory)
+{
+	int rc;
+	DIR *dir;
+	unsigned int e;
+	unsigned int size;
+	struct dirent *dirent;
+	struct scan_entry *entry;
+	struct scan_entry **entries;
+	dir = opendir(directory->path);
+	if (dir == NULL) {
+		fprintf(stderr, "can not read directory: %s\n", directory->path);
+		return;
+	}
+	size = 0;
+	while ((dirent = readdir(dir)) != NULL) {
+		if (strcmp(dirent->d_name, ".") == 0 ||
+		    strcmp(dirent->d_name, "..") == 0) {
+			continue;
+		}
+		entry = scan_entry_new(directory->path, dirent->d_name);
+		if (entry == NULL) {
+			continue;
+		}
+		rc = fstatat(dirfd(dir), dirent->d_name, &entry->stbuf, AT_SYMLINK_NOFOLLOW);
+		if (rc != 0) {
+			fprintf(stderr, "stat failed for %s\n", entry->path);
+			scan_entry_free(entry);
+			continue;
+		}
+		rc = scan_entry_fill(entry, dirfd(dir), dirent->d_name);
+		if (rc != 0) {
+			scan_entry_free(entry);
+			continue;
+		}
+		if (directory->nentries + 1 > size) {
+			entries = realloc(directory->entries, sizeof(struct scan_entry *) * (size * 2 + 16));
+			if (entries == NULL) {
+				fprintf(stderr, "realloc failed\n");
+				scan_entry_free(entry);
+				break;
+			}
+			directory->entries = entries;
+			size = size * 2 + 16;
+		}
+		directory->entries[directory->nentries++] = entry;
+	}
+	closedir(dir);
+	qsort(directory->entries, directory->nentries, sizeof(struct scan_entry *), scan_entry_compare);
+	pthread_mutex_lock(&queue->mutex);
+	for (e = 0; e < directory->nentries; e++) {
+		if (S_ISDIR(directory->entries[e]->stbuf.st_mode)) {
+			scan_queue_push(queue, directory->entries[e]);
+		}
+	}
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static void * scan_job (void *arg)
+{
+	struct scan_queue *queue;
+	struct scan_entry *entry;
+	queue = arg;
+	pthread_mutex_lock(&queue->mutex);
+	while (1) {
+		while (queue->nentries == 0 && queue->busy > 0) {
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+		}
+		if (queue->nentries == 0) {
+			break;
+		}
+		entry = queue->entries[--queue->nentries];
+		queue->busy += 1;
+		pthread_mutex_unlock(&queue->mutex);
+		scan_directory(queue, entry);
+		pthread_mutex_lock(&queue->mutex);
+		queue->busy -= 1;
+		if (queue->busy == 0 && queue->nentries == 0) {
+			pthread_cond_broadcast(&queue->cond);
+		}
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	return NULL;
+}
+
+static void scan_nodes (struct scan_entry *entry, struct node *parent, int level)
 {
-	FTS *tree;
-	FTSENT *entry;
-	char **spaths;
+	unsigned int e;
 	struct node *node;
-	struct source *source;
+	node = node_new(entry, parent);
+	if (node == NULL) {
+		fprintf(stderr, "node new failed\n");
+		return;
+	}
+	if (debug > 1) {
+		int l;
+		for (l = 0; l < level; l++) {
+			fprintf(stdout, " ");
+		}
+		fprintf(stdout, "  %s %s (node: %lld, parent: %lld)\n",
+				(node->type == smashfs_inode_type_regular_file) ? "(f)" :
+				  (node->type == smashfs_inode_type_directory) ? "(d)" :
+				  (node->type == smashfs_inode_type_symbolic_link) ? "(s)" :
+				  "?",
+				entry->name,
+				node->number,
+				(parent != NULL) ? parent->number : -1);
+	}
+	for (e = 0; e < entry->nentries; e++) {
+		scan_nodes(entry->entries[e], node, level + 1);
+	}
+}
+
+static void sources_scan (void)
+{
+	int rc;
+	unsigned int j;
 	unsigned int nsources;
+	struct source *source;
+	struct scan_queue queue;
+	struct scan_entry *root;
+	struct scan_entry *entry;
 	nsources = 0;
 	LIST_FOREACH(source, &sources, sources) {
 		nsources += 1;
 	}
 	fprintf(stdout, "scanning sources: %d\n", nsources);
-	spaths = malloc(sizeof(char *) * (nsources + 1));
-	if (spaths == NULL) {
-		fprintf(stderr, "malloc failed\n");
+	root = scan_entry_new(NULL, "");
+	if (root == NULL) {
 		return;
 	}
+	memset(&queue, 0, sizeof(struct scan_queue));
+	pthread_mutex_init(&queue.mutex, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	root->entries = malloc(sizeof(struct scan_entry *) * nsources);
+	if (root->entries == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto out;
+	}
 	nsources = 0;
 	LIST_FOREACH(source, &sources, sources) {
 		fprintf(stdout, "  setting path: %d, as: %s\n", nsources, source->path);
-		spaths[nsources] = source->path;
 		nsources += 1;
+		entry = scan_entry_new(NULL, source->path);
+		if (entry == NULL) {
+			continue;
+		}
+		rc = stat(entry->path, &entry->stbuf);
+		if (rc != 0) {
+			fprintf(stderr, "stat failed for %s\n", entry->path);
+			scan_entry_free(entry);
+			continue;
+		}
+		rc = scan_entry_fill(entry, AT_FDCWD, entry->path);
+		if (rc != 0) {
+			scan_entry_free(entry);
+			continue;
+		}
+		root->entries[root->nentries++] = entry;
+		if (S_ISDIR(entry->stbuf.st_mode)) {
+			scan_queue_push(&queue, entry);
+		}
 	}
-	spaths[nsources] = NULL;
-	tree = fts_open(spaths, FTS_COMFOLLOW /* | FTS_NOCHDIR */ | FTS_PHYSICAL /* | FTS_SEEDOT */, fts_compare);
-	if (tree == NULL) {
-		fprintf(stderr, "fts_open failed\n");
-		free(spaths);
-		return;
+	qsort(root->entries, root->nentries, sizeof(struct scan_entry *), scan_entry_compare);
+	fprintf(stdout, "  traversing source paths with %d job%s\n", njobs, (njobs > 1) ? "s" : "");
+	for (j = 0; j < njobs; j++) {
+		rc = job_create(j, scan_job, &queue);
+		if (rc != 0) {
+			fprintf(stderr, "job create failed\n");
+			break;
+		}
+	}
+	if (j == 0) {
+		scan_job(&queue);
+	}
+	while (j > 0) {
+		pthread_join(jobs[--j], NULL);
+	}
+	for (j = 0; j < root->nentries; j++) {
+		scan_nodes(root->entries[j], NULL, 0);
 	}
-	fprintf(stdout, "  traversing source paths\n");
-	while ((entry = fts_read(tree))) {
-		if (entry->fts_info == FTS_NSOK) {
-			fprintf(stderr, "A file for which no stat(2) information was\n"
-					"requested. The contents of the fts_statp field are\n"
-					"undefined.\n");
-			fprintf(stderr, "  path: %s\n", entry->fts_path);
-			fprintf(stderr, "  info: 0x%08x\n", entry->fts_info);
+	fprintf(stdout, "  found %d nodes\n", HASH_CNT(hh, nodes_table));
+out:
+	scan_entry_free(root);
+	free(queue.entries);
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.mutex);
+}
+
+struct dedup {
+	struct {
+		long long type;
+		long long size;
+		unsigned long long hash;
+	} key;
+	struct node *node;
+	struct dedup *next;
+	UT_hash_handle hh;
+};
+
+struct hash_job_arg {
+	unsigned int nnodes;
+	unsigned int next;
+	struct node **nodes;
+};
+
+static void * hash_job (void *arg)
+{
+	int fd;
+	ssize_t r;
+	unsigned int n;
+	struct node *node;
+	struct hash hash;
+	struct hash_job_arg *ha;
+	char path[PATH_MAX];
+	unsigned char buffer[64 * 1024];
+	ha = arg;
+	while (1) {
+		pthread_mutex_lock(&job_mutex);
+		n = ha->next++;
+		pthread_mutex_unlock(&job_mutex);
+		if (n >= ha->nnodes) {
+			break;
+		}
+		node = ha->nodes[n];
+		if (node->type == smashfs_inode_type_symbolic_link) {
+			node->hash = hash_buffer(node->symbolic_link->path, strlen(node->symbolic_link->path), 0);
 			continue;
 		}
-		if (entry->fts_info == FTS_ERR) {
-			fprintf(stderr, "This is an error return, and the fts_errno field\n"
-					"will be set to indicate what caused the error.\n");
-			fprintf(stderr, "  path : %s\n", entry->fts_path);
-			fprintf(stderr, "  errno: %d\n", entry->fts_errno);
+		if (node_path(node, path, sizeof(path)) != 0) {
 			continue;
 		}
-		if (entry->fts_info == FTS_NS) {
-			fprintf(stderr, "A file for which no stat(2) information was\n"
-					"available. The contents of the fts_statp field are\n"
-					"undefined. This is an error return, and the\n"
-					"fts_errno field will be set to indicate what caused\n"
-					"the error.\n");
-			fprintf(stderr, "  path : %s\n", entry->fts_path);
-			fprintf(stderr, "  errno: %d\n", entry->fts_errno);
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "open failed for %s\n", path);
 			continue;
 		}
-		if (entry->fts_info == FTS_DNR) {
-			fprintf(stderr, "A directory which cannot be read. This is an error\n"
-					"return, and the fts_errno field will be set to\n"
-					"indicate what caused the error.\n");
-			fprintf(stderr, "  path : %s\n", entry->fts_path);
-			fprintf(stderr, "  errno: %d\n", entry->fts_errno);
+		hash_init(&hash, 0);
+		while ((r = read(fd, buffer, sizeof(buffer))) > 0) {
+			hash_update(&hash, buffer, r);
+		}
+		if (r < 0) {
+			fprintf(stderr, "read failed for %s\n", path);
+		}
+		node->hash = hash_final(&hash);
+		close(fd);
+	}
+	return NULL;
+}
+
+static int node_compare (struct node *a, struct node *b)
+{
+	char apath[PATH_MAX];
+	char bpath[PATH_MAX];
+	if (a->type == smashfs_inode_type_symbolic_link) {
+		return strcmp(a->symbolic_link->path, b->symbolic_link->path);
+	}
+	if (node_path(a, apath, sizeof(apath)) != 0 ||
+	    node_path(b, bpath, sizeof(bpath)) != 0) {
+		return -1;
+	}
+	return file_compare(apath, bpath, a->regular_file->size);
+}
+
+/*
+ * finds regular files and symbolic links with identical contents. nodes
+ * are indexed by (type, size, content hash), hashes are computed on the
+ * job threads, and contents are compared only on an index hit. duplicates
+ * are dropped, directory entries are pointed to the first copy, and the
+ * remaining nodes are numbered again in their original order.
+ */
+static int nodes_dedup (void)
+{
+	int rc;
+	unsigned int j;
+	unsigned int n;
+	unsigned int nnodes;
+	long long *map;
+	long long number;
+	long long e;
+	struct node **nodes;
+	struct node *node;
+	struct node *nnode;
+	struct dedup *dedup;
+	struct dedup *ndedup;
+	struct dedup *index;
+	struct dedup *candidate;
+	struct hash_job_arg hash_job_arg;
+
+	map = NULL;
+	index = NULL;
+	nodes = NULL;
+	dedup = NULL;
+
+	fprintf(stdout, "finding duplicates\n");
+
+	nodes = malloc(sizeof(struct node *) * (nodes_id + 1));
+	map = malloc(sizeof(long long) * (nodes_id + 1));
+	if (nodes == NULL || map == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		goto bail;
+	}
+	nnodes = 0;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		map[node->number] = -1;
+		node->hash = 0;
+		if (node->type == smashfs_inode_type_regular_file ||
+		    node->type == smashfs_inode_type_symbolic_link) {
+			nodes[nnodes++] = node;
+		}
+	}
+
+	fprintf(stdout, "  hashing %d nodes with %d job%s\n", nnodes, njobs, (njobs > 1) ? "s" : "");
+	hash_job_arg.nnodes = nnodes;
+	hash_job_arg.next = 0;
+	hash_job_arg.nodes = nodes;
+	for (j = 0; j < njobs; j++) {
+		rc = job_create(j, hash_job, &hash_job_arg);
+		if (rc != 0) {
+			fprintf(stderr, "job create failed\n");
+			break;
+		}
+	}
+	if (j == 0) {
+		hash_job(&hash_job_arg);
+	}
+	while (j > 0) {
+		pthread_join(jobs[--j], NULL);
+	}
+
+	for (n = 0; n < nnodes; n++) {
+		node = nodes[n];
+		dedup = malloc(sizeof(struct dedup));
+		if (dedup == NULL) {
+			fprintf(stderr, "malloc failed\n");
+			goto bail;
+		}
+		memset(dedup, 0, sizeof(struct dedup));
+		dedup->key.type = node->type;
+		dedup->key.size = (node->type == smashfs_inode_type_regular_file) ? node->regular_file->size : (long long) strlen(node->symbolic_link->path);
+		dedup->key.hash = node->hash;
+		dedup->node = node;
+		HASH_FIND(hh, index, &dedup->key, sizeof(dedup->key), candidate);
+		if (candidate == NULL) {
+			HASH_ADD(hh, index, key, sizeof(dedup->key), dedup);
+			dedup = NULL;
 			continue;
 		}
-		if (entry->fts_info == FTS_DP) {
+		for (; candidate != NULL; candidate = candidate->next) {
+			if (node_compare(candidate->node, node) == 0) {
+				break;
+			}
+		}
+		if (candidate != NULL) {
+			map[node->number] = candidate->node->number;
+			nduplicates += 1;
+			free(dedup);
+			dedup = NULL;
 			continue;
 		}
-		node = node_new(entry);
-		if (node == NULL) {
-			fprintf(stderr, "node new failed\n");
+		HASH_FIND(hh, index, &dedup->key, sizeof(dedup->key), candidate);
+		dedup->next = candidate->next;
+		candidate->next = dedup;
+		dedup = NULL;
+	}
+
+	n = 0;
+	number = 0;
+	HASH_ITER(hh, nodes_table, node, nnode) {
+		if (map[node->number] >= 0) {
+			map[node->number] = map[map[node->number]];
+			node_delete(node);
+		} else {
+			map[node->number] = number++;
+			nodes[n++] = node;
+		}
+	}
+	for (j = 0; j < n; j++) {
+		node = nodes[j];
+		if (node->type != smashfs_inode_type_directory) {
 			continue;
 		}
-		if (debug > 1) {
-			int l;
-			struct node *parent;
-			parent = entry->fts_parent->fts_pointer;
-			for (l = 0; l < entry->fts_level; l++) {
-				fprintf(stdout, " ");
+		node->directory->parent = map[node->directory->parent];
+		for (e = 0; e < node->directory->nentries; e++) {
+			node->directory->entries[e].number = map[node->directory->entries[e].number];
+		}
+	}
+	HASH_CLEAR(hh, nodes_table);
+	for (j = 0; j < n; j++) {
+		nodes[j]->number = j;
+		HASH_ADD(hh, nodes_table, number, sizeof(nodes[j]->number), nodes[j]);
+	}
+	nodes_id = n;
+
+	fprintf(stdout, "  found %lld duplicates\n", nduplicates);
+
+	HASH_ITER(hh, index, dedup, ndedup) {
+		HASH_DEL(index, dedup);
+		while (dedup != NULL) {
+			candidate = dedup->next;
+			free(dedup);
+			dedup = candidate;
+		}
+	}
+	free(nodes);
+	free(map);
+	return 0;
+bail:
+	free(dedup);
+	HASH_ITER(hh, index, dedup, ndedup) {
+		HASH_DEL(index, dedup);
+		while (dedup != NULL) {
+			candidate = dedup->next;
+			free(dedup);
+			dedup = candidate;
+		}
+	}
+	free(nodes);
+	free(map);
+	return -1;
+}
+
+static long long size_parse (const char *string)
+{
+	char *end;
+	long long size;
+	size = strtoll(string, &end, 0);
+	if (end == string) {
+		return -1;
+	}
+	if (*end == 'k' || *end == 'K') {
+		size *= 1024;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		size *= 1024 * 1024;
+		end++;
+	} else if (*end == 'g' || *end == 'G') {
+		size *= 1024 * 1024 * 1024;
+		end++;
+	}
+	if (*end != '\0') {
+		return -1;
+	}
+	return size;
+}
+
+static int candidates_parse (const char *string)
+{
+	char *copy;
+	char *name;
+	char *save;
+	unsigned int c;
+	struct compressor *candidate;
+	copy = strdup(string);
+	if (copy == NULL) {
+		fprintf(stderr, "strdup failed\n");
+		return -1;
+	}
+	ncandidates = 0;
+	for (name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		candidate = compressor_create_name(name);
+		if (candidate == NULL) {
+			fprintf(stderr, "invalid candidate compressor: %s\n", name);
+			free(copy);
+			return -1;
+		}
+		for (c = 0; c < ncandidates; c++) {
+			if (candidates[c] == candidate) {
+				break;
 			}
-			fprintf(stdout, "  %s %s (node: %lld, parent: %lld)\n",
-					(node->type == smashfs_inode_type_regular_file) ? "(f)" :
-					  (node->type == smashfs_inode_type_directory) ? "(d)" :
-					  (node->type == smashfs_inode_type_symbolic_link) ? "(s)" :
-					  "?",
-					entry->fts_name,
-					node->number,
-					(parent != NULL) ? parent->number : -1);
-		}
-	}
-	fts_close(tree);
-	free(spaths);
-	fprintf(stdout, "  found %d nodes\n", HASH_CNT(hh, nodes_table));
+		}
+		if (c == ncandidates) {
+			candidates[ncandidates++] = candidate;
+		}
+	}
+	free(copy);
+	return 0;
 }
 
 static void help_print (const char *pname)
@@ -1199,8 +3174,8 @@ static void help_print (const char *pname)
 	fprintf(stdout, "  -o, --output     : output file\n");
 	fprintf(stdout, "  -b, --block_size : block size (default: %d)\n", block_size);
 	fprintf(stdout, "  -d, --debug      : enable debug output (default: %d)\n", debug);
-	fprintf(stdout, "  -j, --jobs       : enable compressing with jobs (default: %d)\n", njobs);
-	fprintf(stdout, "  -c, --compressor : select compressor (gzip, lzma, lzo, xz) (default: none)\n");
+	fprintf(stdout, "  -j, --jobs       : number of jobs (default: online cpu count)\n");
+	fprintf(stdout, "  -c, --compressor : select compressor (gzip, lzma, lzo, xz, zstd, lz4) (default: none)\n");
 	fprintf(stdout, "  --no_group_mode  : disable group mode\n");
 	fprintf(stdout, "  --no_other_mode  : disable other mode\n");
 	fprintf(stdout, "  --no_uid         : disable uid\n");
@@ -1209,6 +3184,14 @@ static void help_print (const char *pname)
 	fprintf(stdout, "  --no_mtime       : disable mtime\n");
 	fprintf(stdout, "  --no_padding     : disable padding\n");
 	fprintf(stdout, "  --no_duplicates  : disable duplicate file checking\n");
+	fprintf(stdout, "  --memory-limit   : memory for blocks in flight, K/M/G suffixes (default: %lldM)\n", memory_limit / (1024 * 1024));
+	fprintf(stdout, "  --affinity       : pin jobs to cpus\n");
+	fprintf(stdout, "  --level          : compression level (default: compressor default)\n");
+	fprintf(stdout, "  --long           : enable long distance matching (zstd)\n");
+	fprintf(stdout, "  --candidates     : compressors tried for each block, comma separated (default: compressor)\n");
+	fprintf(stdout, "  --decode-weight  : weight of decode cost against compressed size, with several candidates (default: %u)\n", decode_weight);
+	fprintf(stdout, "  --dictionary     : train a zstd dictionary of given size, K/M suffixes (default: off)\n");
+	fprintf(stdout, "  --elf-split      : pack code, read-only data and the rest of elf files apart\n");
 }
 
 int main (int argc, char *argv[])
@@ -1219,6 +3202,7 @@ int main (int argc, char *argv[])
 	struct node *node;
 	struct node *nnode;
 	struct source *source;
+	unsigned int n;
 	unsigned int nsources;
 	static struct option long_options[] = {
 		{"source"       , required_argument, 0, 's' },
@@ -1226,7 +3210,7 @@ int main (int argc, char *argv[])
 		{"block_size"   , required_argument, 0, 'b' },
 		{"compressor"   , required_argument, 0, 'c' },
 		{"debug"        , no_argument      , 0, 'd' },
-		{"jobs"         , no_argument      , 0, 'j' },
+		{"jobs"         , required_argument, 0, 'j' },
 		{"no_group_mode", no_argument      , 0, 0x100 },
 		{"no_other_mode", no_argument      , 0, 0x101 },
 		{"no_uid"       , no_argument      , 0, 0x102 },
@@ -1235,11 +3219,20 @@ int main (int argc, char *argv[])
 		{"no_mtime"     , no_argument      , 0, 0x105 },
 		{"no_padding"   , no_argument      , 0, 0x106 },
 		{"no_duplicates", no_argument      , 0, 0x107 },
+		{"memory-limit" , required_argument, 0, 0x108 },
+		{"affinity"     , no_argument      , 0, 0x109 },
+		{"level"        , required_argument, 0, 0x10a },
+		{"long"         , no_argument      , 0, 0x10b },
+		{"candidates"   , required_argument, 0, 0x10c },
+		{"decode-weight", required_argument, 0, 0x10d },
+		{"dictionary"   , required_argument, 0, 0x10e },
+		{"elf-split"    , no_argument      , 0, 0x10f },
 		{"help"         , no_argument      , 0, 'h' },
 		{ 0             , 0                , 0,  0 }
 	};
 	rc = 0;
 	option_index = 0;
+	arena_init(&nodes_arena, 1024 * 1024);
 	compressor = compressor_create_name("none");
 	while ((c = getopt_long(argc, argv, "hdj:s:o:b:c:", long_options, &option_index)) != -1) {
 		switch (c) {
@@ -1282,7 +3275,7 @@ int main (int argc, char *argv[])
 				debug += 1;
 				break;
 			case 'j':
-				njobs = MIN(MAX_JOBS, atoi(optarg));
+				njobs = MAX(0, atoi(optarg));
 				break;
 			case 0x100:
 				no_group_mode = 1;
@@ -1308,6 +3301,43 @@ int main (int argc, char *argv[])
 			case 0x107:
 				no_duplicates = 1;
 				break;
+			case 0x108:
+				memory_limit = size_parse(optarg);
+				if (memory_limit <= 0) {
+					fprintf(stderr, "invalid memory limit: %s\n", optarg);
+					rc = -1;
+					goto bail;
+				}
+				break;
+			case 0x109:
+				job_affinity = 1;
+				break;
+			case 0x10a:
+				compressor_options.level = atoi(optarg);
+				break;
+			case 0x10b:
+				compressor_options.long_distance = 1;
+				break;
+			case 0x10c:
+				rc = candidates_parse(optarg);
+				if (rc != 0) {
+					goto bail;
+				}
+				break;
+			case 0x10d:
+				decode_weight = MAX(0, atoi(optarg));
+				break;
+			case 0x10e:
+				dictionary_size = size_parse(optarg);
+				if (dictionary_size < 0 || dictionary_size > 16 * 1024 * 1024) {
+					fprintf(stderr, "invalid dictionary size: %s\n", optarg);
+					rc = -1;
+					goto bail;
+				}
+				break;
+			case 0x10f:
+				elf_split = 1;
+				break;
 			case 'h':
 				help_print(argv[0]);
 				exit(0);
@@ -1332,7 +3362,31 @@ int main (int argc, char *argv[])
 		rc = -1;
 		goto bail;
 	}
+	compressor_set_options(compressor, &compressor_options);
+	if (ncandidates == 0) {
+		candidates[ncandidates++] = compressor;
+	}
+	for (n = 0; n < ncandidates; n++) {
+		compressor_set_options(candidates[n], &compressor_options);
+	}
+	if (njobs == 0) {
+		njobs = MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+	}
+	jobs = malloc(sizeof(pthread_t) * njobs);
+	if (jobs == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		rc = -1;
+		goto bail;
+	}
 	sources_scan();
+	if (no_duplicates == 0) {
+		rc = nodes_dedup();
+		if (rc != 0) {
+			fprintf(stderr, "nodes dedup failed\n");
+			rc = -1;
+			goto bail;
+		}
+	}
 	rc = output_write();
 	if (rc != 0) {
 		fprintf(stderr, "output write failed\n");
@@ -1354,7 +3408,10 @@ bail:
 	HASH_ITER(hh, nodes_table, node, nnode) {
 		node_delete(node);
 	}
+	arena_uninit(&nodes_arena);
+	free(jobs);
 	free(output);
+	free(dictionary);
 	compressor_destroy(compressor);
 	return rc;
 }
@@ -64,12 +64,16 @@ struct node {
 	long long size;
 	long long block;
 	long long index;
+	long long extents;
 };
 
 struct block {
 	long long offset;
 	long long size;
 	long long compressed_size;
+	long long stored;
+	long long type;
+	long long bcj;
 };
 
 static int node_fill (long long number, struct node *node)
@@ -94,6 +98,7 @@ static int node_fill (long long number, struct node *node)
 	node->size       = bitbuffer_getbits(&bitbuffer, super.bits.inode.size);
 	node->block      = bitbuffer_getbits(&bitbuffer, super.bits.inode.block);
 	node->index      = bitbuffer_getbits(&bitbuffer, super.bits.inode.index);
+	node->extents    = bitbuffer_getbits(&bitbuffer, super.bits.inode.extents);
 	bitbuffer_uninit(&bitbuffer);
 	if (super.bits.inode.group_mode == 0) {
 		node->group_mode = node->owner_mode;
@@ -128,6 +133,9 @@ static int block_fill (long long number, struct block *block)
 	bitbuffer_setpos(&bitbuffer, number * max_block_size);
 	block->offset           = bitbuffer_getbits(&bitbuffer, super.bits.block.offset);
 	block->compressed_size  = bitbuffer_getbits(&bitbuffer, super.bits.block.compressed_size) + super.min.block.compressed_size;
+	block->stored           = bitbuffer_getbits(&bitbuffer, super.bits.block.stored);
+	block->type             = (super.bits.block.type > 0) ? bitbuffer_getbits(&bitbuffer, super.bits.block.type) : super.compression_type;
+	block->bcj              = bitbuffer_getbits(&bitbuffer, super.bits.block.bcj);
 	block->size             = (number + 1 < super.blocks) ? super.block_size : bitbuffer_getbits(&bitbuffer, super.bits.block.size);
 	bitbuffer_uninit(&bitbuffer);
 	if (debug > 2) {
@@ -135,12 +143,15 @@ static int block_fill (long long number, struct block *block)
 		fprintf(stdout, "  number: %lld\n", number);
 		fprintf(stdout, "  offset: %lld\n", block->offset);
 		fprintf(stdout, "  csize : %lld\n", block->compressed_size);
+		fprintf(stdout, "  stored: %lld\n", block->stored);
+		fprintf(stdout, "  type  : %lld\n", block->type);
+		fprintf(stdout, "  bcj   : %lld\n", block->bcj);
 		fprintf(stdout, "  size  : %lld\n", block->size);
 	}
 	return 0;
 }
 
-static int node_read (struct node *node, int (*function) (void *context, void *buffer, long long size), void *context)
+static int entries_read (long long offset, long long size, int (*function) (void *context, void *buffer, long long size), void *context)
 {
 	int rc;
 	long long s;
@@ -148,10 +159,11 @@ static int node_read (struct node *node, int (*function) (void *context, void *b
 	long long b;
 	void *bbuffer;
 	struct block block;
+	struct compressor *bcompressor;
 	s = 0;
-	i = node->index;
-	b = node->block;
-	while (s < node->size) {
+	i = offset & ((1 << super.block_log2) - 1);
+	b = offset >> super.block_log2;
+	while (s < size) {
 		rc = block_fill(b, &block);
 		if (rc != 0) {
 			fprintf(stderr, "block fill failed\n");
@@ -162,31 +174,112 @@ static int node_read (struct node *node, int (*function) (void *context, void *b
 			fprintf(stderr, "malloc failed\n");
 			return -1;
 		}
-		rc = compressor_uncompress(compressor, buffer_buffer(&entry_buffer) + block.offset, block.compressed_size, bbuffer, block.size);
+		if (block.stored && block.compressed_size == 0) {
+			memset(bbuffer, 0, block.size);
+			rc = block.size;
+		} else if (block.stored) {
+			memcpy(bbuffer, buffer_buffer(&entry_buffer) + block.offset, block.size);
+			rc = block.size;
+		} else {
+			bcompressor = compressor_create_type(block.type);
+			if (bcompressor == NULL) {
+				fprintf(stderr, "compressor create failed for type: %lld\n", block.type);
+				rc = -1;
+			} else {
+				rc = compressor_uncompress(bcompressor, buffer_buffer(&entry_buffer) + block.offset, block.compressed_size, bbuffer, block.size);
+			}
+		}
 		if (rc < 0) {
 			fprintf(stderr, "block read failed\n");
 			free(bbuffer);
 			return -1;
 		}
-		rc = function(context, bbuffer + i, MIN(node->size - s, block.size - i));
-		if (rc != MIN(node->size - s, block.size - i)) {
+		rc = function(context, bbuffer + i, MIN(size - s, block.size - i));
+		if (rc != MIN(size - s, block.size - i)) {
 			fprintf(stderr, "function failed\n");
 			free(bbuffer);
 			return -1;
 		}
 		free(bbuffer);
-		s += MIN(node->size - s, block.size - i);
+		s += MIN(size - s, block.size - i);
 		b += 1;
 		i = 0;
 	}
 	return 0;
 }
 
+static int node_read_extents (void *context, void *buffer, long long size)
+{
+	unsigned char **b;
+	b = context;
+	memcpy(*b, buffer, size);
+	*b += size;
+	return size;
+}
+
+/*
+ * split files are read extent by extent, as listed in their extent map.
+ */
+static int node_read (struct node *node, int (*function) (void *context, void *buffer, long long size), void *context)
+{
+	int rc;
+	long long e;
+	long long size;
+	long long offset;
+	unsigned char *map;
+	unsigned char *b;
+	struct bitbuffer bitbuffer;
+	offset = (node->block << super.block_log2) + node->index;
+	if (node->extents == 0) {
+		return entries_read(offset, node->size, function, context);
+	}
+	map = malloc(node->extents * SMASHFS_EXTENT_SIZE);
+	if (map == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+	b = map;
+	rc = entries_read(offset, node->extents * SMASHFS_EXTENT_SIZE, node_read_extents, &b);
+	if (rc != 0) {
+		fprintf(stderr, "extents read failed\n");
+		free(map);
+		return -1;
+	}
+	bitbuffer_init_from_buffer(&bitbuffer, map, node->extents * SMASHFS_EXTENT_SIZE);
+	for (e = 0; e < node->extents; e++) {
+		offset = bitbuffer_getbits(&bitbuffer, 32);
+		size = bitbuffer_getbits(&bitbuffer, 32);
+		if (debug > 2) {
+			fprintf(stdout, "  extent: %lld, offset: %lld, size: %lld\n", e, offset, size);
+		}
+		rc = entries_read(offset, size, function, context);
+		if (rc != 0) {
+			break;
+		}
+	}
+	bitbuffer_uninit(&bitbuffer);
+	free(map);
+	return rc;
+}
+
+/*
+ * zeros are skipped instead of written, and the file is truncated to its
+ * size at the end, so holes of sparse files are made again.
+ */
 static int node_read_regular_file (void *context, void *buffer, long long size)
 {
 	int rc;
 	int *fd;
+	unsigned char *b;
 	fd = context;
+	b = buffer;
+	if (size > 0 && b[0] == 0 && memcmp(b, b + 1, size - 1) == 0) {
+		if (lseek(*fd, size, SEEK_CUR) < 0) {
+			fprintf(stderr, "seek failed\n");
+			return -1;
+		}
+		return size;
+	}
 	rc = write(*fd, buffer, size);
 	if (rc != size) {
 		fprintf(stderr, "write failed\n");
@@ -324,18 +417,28 @@ static void traverse (long long inode, const char *name, long long level)
 		s += super.bits.inode.directory.nentries;
 		s  = (s + 7) / 8;
 		buffer += s;
+		s  = (super.bits.inode.directory.index + 7) / 8;
+		buffer += s * directory_nentries;
 		for (e = 0; e < directory_nentries; e++) {
 			s  = 0;
 			s += super.bits.inode.directory.entries.number;
 			s += super.bits.inode.directory.entries.length;
 			s += super.bits.inode.directory.entries.type;
 			s  = (s + 7) / 8;
+			if (buffer + s > nbuffer + node.size) {
+				fprintf(stderr, "invalid directory entry offset: %lld\n", (long long) (buffer - nbuffer));
+				break;
+			}
 			bitbuffer_init_from_buffer(&bitbuffer, buffer, s);
 			directory_entry_number = bitbuffer_getbits(&bitbuffer, super.bits.inode.directory.entries.number);
 			directory_entry_length = bitbuffer_getbits(&bitbuffer, super.bits.inode.directory.entries.length);
 			/* directory_entry_type */ bitbuffer_skipbits(&bitbuffer, super.bits.inode.directory.entries.type);
 			bitbuffer_uninit(&bitbuffer);
 			buffer += s;
+			if (buffer + directory_entry_length > nbuffer + node.size) {
+				fprintf(stderr, "invalid directory entry length: %lld\n", directory_entry_length);
+				break;
+			}
 			path = strndup((char *) buffer, directory_entry_length);
 			if (path == NULL) {
 				fprintf(stderr, "strndup failed\n");
@@ -363,6 +466,9 @@ static void traverse (long long inode, const char *name, long long level)
 			return;
 		}
 		rc = node_read(&node, node_read_regular_file, &fd);
+		if (rc == 0) {
+			rc = ftruncate(fd, node.size);
+		}
 		if (rc != 0) {
 			fprintf(stderr, "node read failed\n");
 			rc = chdir("..");
@@ -437,6 +543,7 @@ int main (int argc, char *argv[])
 	unsigned int cbsize;
 	unsigned char *buffer;
 	unsigned char *cbuffer;
+	unsigned char *dictionary;
 	char *cwd;
 	static struct option long_options[] = {
 		{"source"    , required_argument, 0, 's' },
@@ -451,6 +558,7 @@ int main (int argc, char *argv[])
 	cbsize = 0;
 	buffer = NULL;
 	cbuffer = NULL;
+	dictionary = NULL;
 	rc = 0;
 	option_index = 0;
 	buffer_init(&inode_buffer);
@@ -508,6 +616,11 @@ int main (int argc, char *argv[])
 		rc = -1;
 		goto bail;
 	}
+	if (super.version != SMASHFS_VERSION) {
+		fprintf(stderr, "version mismatch: 0x%08x, expected: 0x%08x\n", super.version, SMASHFS_VERSION);
+		rc = -1;
+		goto bail;
+	}
 	if (debug > 0) {
 		fprintf(stdout, "  super block:\n");
 		fprintf(stdout, "    magic         : 0x%08x, %u\n", super.magic, super.magic);
@@ -521,10 +634,17 @@ int main (int argc, char *argv[])
 		fprintf(stdout, "    inodes_offset : 0x%08x, %u\n", super.inodes_offset, super.inodes_offset);
 		fprintf(stdout, "    inodes_size   : 0x%08x, %u\n", super.inodes_size, super.inodes_size);
 		fprintf(stdout, "    inodes_csize  : 0x%08x, %u\n", super.inodes_size, super.inodes_csize);
+		fprintf(stdout, "    filters_offset: 0x%08x, %u\n", super.filters_offset, super.filters_offset);
+		fprintf(stdout, "    filters_size  : 0x%08x, %u\n", super.filters_size, super.filters_size);
 		fprintf(stdout, "    blocks_offset : 0x%08x, %u\n", super.blocks_offset, super.blocks_offset);
 		fprintf(stdout, "    blocks_size   : 0x%08x, %u\n", super.blocks_size, super.blocks_size);
 		fprintf(stdout, "    entries_offset: 0x%08x, %u\n", super.entries_offset, super.entries_offset);
 		fprintf(stdout, "    entries_size  : 0x%08x, %u\n", super.entries_size, super.entries_size);
+		fprintf(stdout, "    compression   : 0x%08x, %u\n", super.compression_type, super.compression_type);
+		fprintf(stdout, "    compressions  : 0x%08x, %u\n", super.compression_types, super.compression_types);
+		fprintf(stdout, "    dictionary_offset: 0x%08x, %u\n", super.dictionary_offset, super.dictionary_offset);
+		fprintf(stdout, "    dictionary_size  : 0x%08x, %u\n", super.dictionary_size, super.dictionary_size);
+		fprintf(stdout, "    bcj_types        : 0x%08x, %u\n", super.bcj_types, super.bcj_types);
 		fprintf(stdout, "    bits:\n");
 		fprintf(stdout, "      min:\n");
 		fprintf(stdout, "        inode:\n");
@@ -544,10 +664,12 @@ int main (int argc, char *argv[])
 		fprintf(stdout, "        size      : %u\n", super.bits.inode.size);
 		fprintf(stdout, "        block     : %u\n", super.bits.inode.block);
 		fprintf(stdout, "        index     : %u\n", super.bits.inode.index);
+		fprintf(stdout, "        extents   : %u\n", super.bits.inode.extents);
 		fprintf(stdout, "        regular_file:\n");
 		fprintf(stdout, "        directory:\n");
 		fprintf(stdout, "          parent   : %u\n", super.bits.inode.directory.parent);
 		fprintf(stdout, "          nentries : %u\n", super.bits.inode.directory.nentries);
+		fprintf(stdout, "          index    : %u\n", super.bits.inode.directory.index);
 		fprintf(stdout, "          entries:\n");
 		fprintf(stdout, "            number : %u\n", super.bits.inode.directory.entries.number);
 		fprintf(stdout, "            length : %u\n", super.bits.inode.directory.entries.length);
@@ -557,6 +679,11 @@ int main (int argc, char *argv[])
 		fprintf(stdout, "        offset         : %u\n", super.bits.block.offset);
 		fprintf(stdout, "        compressed_size: %u\n", super.bits.block.compressed_size);
 		fprintf(stdout, "        size           : %u\n", super.bits.block.size);
+		fprintf(stdout, "        stored         : %u\n", super.bits.block.stored);
+		fprintf(stdout, "        type           : %u\n", super.bits.block.type);
+		fprintf(stdout, "        bcj            : %u\n", super.bits.block.bcj);
+		fprintf(stdout, "      filter:\n");
+		fprintf(stdout, "        offset         : %u\n", super.bits.filter.offset);
 	}
 	fprintf(stdout, "creating compressor\n");
 	compressor = compressor_create_type(super.compression_type);
@@ -565,6 +692,27 @@ int main (int argc, char *argv[])
 		rc = -1;
 		goto bail;
 	}
+	if (super.dictionary_size > 0) {
+		fprintf(stdout, "reading dictionary\n");
+		dictionary = malloc(super.dictionary_size);
+		if (dictionary == NULL) {
+			fprintf(stderr, "malloc failed\n");
+			rc = -1;
+			goto bail;
+		}
+		rc = pread(fd, dictionary, super.dictionary_size, super.dictionary_offset);
+		if (rc != (int) super.dictionary_size) {
+			fprintf(stderr, "read failed for dictionary\n");
+			rc = -1;
+			goto bail;
+		}
+		if (compressor_create_type(smashfs_compression_type_zstd) == NULL) {
+			fprintf(stderr, "dictionary needs zstd compressor\n");
+			rc = -1;
+			goto bail;
+		}
+		compressor_set_dictionary(compressor_create_type(smashfs_compression_type_zstd), dictionary, super.dictionary_size);
+	}
 	fprintf(stdout, "reading inode table\n");
 	bsize = 1024;
 	buffer = malloc(bsize);
@@ -673,9 +821,13 @@ int main (int argc, char *argv[])
 	max_inode_size += super.bits.inode.size;
 	max_inode_size += super.bits.inode.block;
 	max_inode_size += super.bits.inode.index;
+	max_inode_size += super.bits.inode.extents;
 	max_block_size  = 0;
 	max_block_size += super.bits.block.offset;
 	max_block_size += super.bits.block.compressed_size;
+	max_block_size += super.bits.block.stored;
+	max_block_size += super.bits.block.type;
+	max_block_size += super.bits.block.bcj;
 	if (debug > 2) {
 		struct bitbuffer bitbuffer;
 		rc = bitbuffer_init_from_buffer(&bitbuffer, buffer_buffer(&inode_buffer), buffer_length(&inode_buffer));
@@ -743,6 +895,7 @@ bail:
 	free(cwd);
 	free(buffer);
 	free(cbuffer);
+	free(dictionary);
 	free(source);
 	free(output);
 	buffer_uninit(&entry_buffer);